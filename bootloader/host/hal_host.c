@@ -0,0 +1,299 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+// Library Imports
+#include <errno.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+// Application Imports
+#include "uart.h"
+#include "hal.h"
+#include "sim.h"
+
+/*
+ * Host implementation of hal.h.
+ *
+ * Flash is a byte array with NOR semantics: erase sets a page to 0xFF and
+ * programming can only clear bits. UART1 input comes from a script buffer;
+ * running out of script looks like a timeout to a bounded wait and ends
+ * the run for an unbounded one. Scripts run on a virtual clock that only
+ * moves when a wait times out, so timeouts cost no real time.
+ * Alternatively UART1 and UART2 are connected sockets, waited on with
+ * real timeouts, where closing UART1 counts as the end of the script.
+ * UART2 output then goes to its socket as well as stderr.
+ * Reset and boot unwind back to sim_run().
+ */
+
+// bootloader.c is built with -Dmain=bootloader_main
+int bootloader_main(void);
+
+uint8_t sim_flash[SIM_FLASH_SIZE];
+sim_stats sim_counters;
+volatile uint32_t sim_mailbox[SIM_MAILBOX_WORDS];
+
+static const uint8_t *script = NULL;
+static uint32_t script_len = 0;
+static uint32_t script_pos = 0;
+
+static int uart1_fd = -1;
+static int uart2_fd = -1;
+
+// UART2 socket output is sent a line at a time. The kernel charges each
+// send for far more than one byte, so byte-sized sends fill the socket
+// long before the client has a line worth reading.
+static uint8_t uart2_out[256];
+static uint32_t uart2_out_len = 0;
+static uint32_t script_ms = 0; // Virtual clock for scripts
+
+static FILE *tx_file = NULL;
+static int quiet = 0;
+
+static uint8_t *initial_fw = NULL;
+static uint32_t initial_fw_len = 0;
+
+static jmp_buf exit_env;
+
+void sim_set_script(const uint8_t *data, uint32_t len){
+    script = data;
+    script_len = len;
+    script_pos = 0;
+}
+
+void sim_set_uart1_socket(int fd){
+    uart1_fd = fd;
+}
+
+void sim_set_uart2_socket(int fd){
+    uart2_fd = fd;
+}
+
+uint32_t sim_script_remaining(void){
+    return script_len - script_pos;
+}
+
+void sim_set_tx(FILE *tx){
+    tx_file = tx;
+}
+
+void sim_set_quiet(int q){
+    quiet = q;
+}
+
+void sim_set_initial_firmware(uint8_t *data, uint32_t len){
+    initial_fw = data;
+    initial_fw_len = len;
+}
+
+int sim_run(void){
+    int code = setjmp(exit_env);
+    if (code == 0){
+        bootloader_main();
+        // main() never returns on target
+        code = SIM_EXIT_IDLE;
+    }
+    return code;
+}
+
+/* ****************************************************************
+ *
+ * hal.h
+ *
+ * ****************************************************************
+ */
+void hal_init(void){
+}
+
+// Sends the buffered UART2 output, blocking like the UART1 path so the
+// TYPE/OK answers of a striped update are never dropped
+static void uart2_flush(void){
+    uint32_t sent = 0;
+
+    while (uart2_fd >= 0 && sent < uart2_out_len){
+        ssize_t n = send(uart2_fd, uart2_out + sent, uart2_out_len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR){
+            continue;
+        }
+        if (n <= 0){
+            break; // Client gone
+        }
+        sent += n;
+    }
+    uart2_out_len = 0;
+}
+
+// hal_event_wait() with UART1 and UART2 on sockets
+static void socket_event_wait(uint32_t timeout_ms, uint8_t inputs, hal_event *ev){
+    struct pollfd pfd[2] = {{-1, POLLIN, 0}, {-1, POLLIN, 0}};
+
+    // Everything written so far goes out before waiting for an answer
+    uart2_flush();
+
+    if (inputs & HAL_INPUT(UART1)){
+        pfd[0].fd = uart1_fd;
+    }
+    if (inputs & HAL_INPUT(UART2)){
+        pfd[1].fd = uart2_fd;
+    }
+
+    while (poll(pfd, 2, timeout_ms == RX_FOREVER ? -1 : (int)timeout_ms) > 0){
+        for (int i = 0; i < 2; i++){
+            if (!pfd[i].revents){
+                continue;
+            }
+            if (recv(pfd[i].fd, &ev->byte, 1, 0) == 1){
+                ev->type = HAL_EVENT_RX;
+                ev->uart = i ? UART2 : UART1;
+                if (i == 0){
+                    sim_counters.rx_bytes++;
+                }
+                return;
+            }
+            if (i == 0){
+                // Host hung up
+                longjmp(exit_env, SIM_EXIT_IDLE);
+            }
+            // Nobody on the console any more
+            uart2_fd = -1;
+            pfd[1].fd = -1;
+        }
+    }
+    ev->type = HAL_EVENT_TIMER;
+    if (timeout_ms != 0){
+        sim_counters.rx_timeouts++;
+    }
+}
+
+void hal_event_wait(uint32_t timeout_ms, uint8_t inputs, hal_event *ev){
+    if (uart1_fd >= 0){
+        socket_event_wait(timeout_ms, inputs, ev);
+        return;
+    }
+    if ((inputs & HAL_INPUT(UART1)) && script_pos < script_len){
+        ev->type = HAL_EVENT_RX;
+        ev->uart = UART1;
+        ev->byte = script[script_pos++];
+        sim_counters.rx_bytes++;
+        return;
+    }
+    if (timeout_ms == RX_FOREVER){
+        longjmp(exit_env, SIM_EXIT_IDLE);
+    }
+    ev->type = HAL_EVENT_TIMER;
+    if (timeout_ms != 0){
+        script_ms += timeout_ms;
+        sim_counters.rx_timeouts++;
+    }
+}
+
+uint32_t hal_clock_ms(void){
+    struct timespec ts;
+
+    if (uart1_fd < 0){
+        return script_ms;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long hal_flash_erase(uint32_t addr){
+    if (addr % SIM_FLASH_PAGESIZE || addr >= SIM_FLASH_SIZE){
+        return -1;
+    }
+    memset(sim_flash + addr, 0xFF, SIM_FLASH_PAGESIZE);
+    sim_counters.erases++;
+    return 0;
+}
+
+long hal_flash_program(uint32_t *data, uint32_t addr, uint32_t len){
+    if (addr % 4 || len % 4 || addr + len > SIM_FLASH_SIZE){
+        sim_counters.program_errors++;
+        return -1;
+    }
+    uint8_t *src = (uint8_t *)data;
+    for (uint32_t i = 0; i < len; i++){
+        sim_flash[addr + i] &= src[i];
+    }
+    sim_counters.words_programmed += len / 4;
+    return 0;
+}
+
+uint8_t *hal_flash_addr(uint32_t addr){
+    return sim_flash + addr;
+}
+
+volatile uint32_t *hal_mailbox(void){
+    return sim_mailbox;
+}
+
+uint8_t *hal_initial_firmware(uint32_t *size){
+    *size = initial_fw_len;
+    return initial_fw;
+}
+
+void hal_stats_report(uint8_t uart){
+    uart_write_str(uart, "Erases: ");
+    uart_write_hex(uart, sim_counters.erases);
+    uart_write_str(uart, "\nWords programmed: ");
+    uart_write_hex(uart, sim_counters.words_programmed);
+    uart_write_str(uart, "\nBytes received: ");
+    uart_write_hex(uart, sim_counters.rx_bytes);
+    nl(uart);
+}
+
+void hal_reset(void){
+    uart2_flush();
+    longjmp(exit_env, SIM_EXIT_RESET);
+}
+
+void hal_boot(void){
+    uart2_flush();
+    longjmp(exit_env, SIM_EXIT_BOOT);
+}
+
+/* ****************************************************************
+ *
+ * uart.h write side: UART1 goes to the socket or TX capture, UART2 to
+ * stderr and its socket
+ *
+ * ****************************************************************
+ */
+void uart_write(uint8_t uart, uint32_t data){
+    uint8_t byte = data & 0xFF;
+
+    if (uart == UART1 && uart1_fd >= 0){
+        send(uart1_fd, &byte, 1, MSG_NOSIGNAL);
+    } else if (uart == UART1 && tx_file){
+        fputc(data & 0xFF, tx_file);
+    } else if (uart == UART2){
+        if (uart2_fd >= 0){
+            uart2_out[uart2_out_len++] = byte;
+            if (byte == '\n' || uart2_out_len == sizeof(uart2_out)){
+                uart2_flush();
+            }
+        }
+        if (!quiet){
+            fputc(data & 0xFF, stderr);
+        }
+    }
+}
+
+void uart_write_str(uint8_t uart, char *str){
+    while (*str){
+        uart_write(uart, (uint8_t)*str++);
+    }
+}
+
+void uart_write_hex(uint8_t uart, uint32_t data){
+    char buf[11];
+    snprintf(buf, sizeof(buf), "0x%08X", data);
+    uart_write_str(uart, buf);
+}
+
+void nl(uint8_t uart){
+    uart_write(uart, '\n');
+}
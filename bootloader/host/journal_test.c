@@ -0,0 +1,140 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+// Library Imports
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// Application Imports
+#include "uart.h"
+#include "hal.h"
+#include "journal.h"
+
+/*
+ * Tests for journal.c on a flash array of its own, with NOR semantics:
+ * erase sets a page to 0xFF and programming can only clear bits.
+ * Run with `make test`; exits non-zero if any check fails.
+ */
+
+#define FLASH_SIZE 0x40000
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static uint8_t flash[FLASH_SIZE];
+static int failures = 0;
+static int erases_losing_latest = 0; // Erases of the page with the newest record
+
+uint8_t *hal_flash_addr(uint32_t addr){
+    return flash + addr;
+}
+
+long hal_flash_erase(uint32_t addr){
+    uint8_t *latest = (uint8_t *)journal_latest();
+
+    if (latest && latest >= flash + addr && latest < flash + addr + JOURNAL_PAGESIZE){
+        erases_losing_latest++;
+    }
+    memset(flash + addr, 0xFF, JOURNAL_PAGESIZE);
+    return 0;
+}
+
+long hal_flash_program(uint32_t *data, uint32_t addr, uint32_t len){
+    uint8_t *src = (uint8_t *)data;
+
+    for (uint32_t i = 0; i < len; i++){
+        flash[addr + i] &= src[i];
+    }
+    return 0;
+}
+
+// journal_report() output is not checked
+void uart_write(uint8_t uart, uint32_t data){}
+void uart_write_str(uint8_t uart, char *str){}
+void uart_write_hex(uint8_t uart, uint32_t data){}
+void nl(uint8_t uart){}
+
+static void check(int ok, const char *what, int line){
+    if (!ok){
+        fprintf(stderr, "journal_test.c:%d: %s\n", line, what);
+        failures++;
+    }
+}
+
+static void erase_all(void){
+    memset(flash, 0xFF, sizeof(flash));
+}
+
+// A record in slot 0 that lost power before its commit word must not
+// be read as pre-journal metadata, or its magic becomes the version
+static void test_torn_slot0(void){
+    uint8_t record[JOURNAL_RECORD_SIZE];
+
+    erase_all();
+    journal_init();
+    CHECK(journal_commit(2, 0x1000, 10, NULL, NULL) == 0);
+    memcpy(record, hal_flash_addr(METADATA_BASE), sizeof(record));
+
+    erase_all();
+    memcpy(hal_flash_addr(METADATA_BASE), record, offsetof(journal_record, commit));
+    journal_init();
+    CHECK(journal_latest() == NULL);
+
+    // The next install is recorded as itself
+    CHECK(journal_commit(3, 0x2000, 10, NULL, NULL) == 0);
+    journal_record *latest = journal_latest();
+    CHECK(latest != NULL && latest->version == 3 && latest->fw_size == 0x2000);
+}
+
+// Metadata from before the journal is carried into the first record
+static void test_old_layout(void){
+    uint32_t word = 5 | (0x1234 << 16);
+
+    erase_all();
+    hal_flash_program(&word, METADATA_BASE, 4);
+    journal_init();
+
+    journal_record *latest = journal_latest();
+    CHECK(latest != NULL && latest->version == 5 && latest->fw_size == 0x1234);
+    CHECK(latest != NULL && latest->update_count == 1);
+}
+
+// A page with more than the one word programmed is not the old layout
+static void test_not_old_layout(void){
+    uint32_t words[2] = {5 | (0x1234 << 16), 0};
+
+    erase_all();
+    hal_flash_program(words, METADATA_BASE + 8, 8);
+    hal_flash_program(words, METADATA_BASE, 4);
+    journal_init();
+    CHECK(journal_latest() == NULL);
+}
+
+// Filling the journal many times over never erases the newest record,
+// so a power loss at any point still leaves one, and counters carry on
+static void test_compaction(void){
+    erase_all();
+    journal_init();
+    erases_losing_latest = 0;
+
+    for (uint32_t i = 0; i < 5 * JOURNAL_SLOTS; i++){
+        CHECK(journal_commit(i, 0x100, 1, NULL, NULL) == 0);
+        journal_record *latest = journal_latest();
+        CHECK(latest != NULL && latest->seq == i && latest->version == i && latest->update_count == i + 1);
+    }
+    CHECK(erases_losing_latest == 0);
+    CHECK(journal_latest()->journal_erases == 5 * JOURNAL_SLOTS / JOURNAL_PAGE_SLOTS - 1);
+}
+
+int main(void){
+    test_torn_slot0();
+    test_old_layout();
+    test_not_old_layout();
+    test_compaction();
+
+    if (failures){
+        fprintf(stderr, "journal_test: %d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("journal_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,301 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+/*
+ * Host driver for the bootloader.
+ *
+ *   bl_host [-i initial.bin] [-f flash.bin] [-o flash.bin] [-t tx.bin] [-q] script.bin
+ *       Feeds script.bin to UART1 (e.g. "U" followed by protected.bin) and
+ *       runs the bootloader until the script is used up, rebooting it on
+ *       every reset. Flash persists between reboots and runs via -f/-o.
+ *
+ *   bl_host [-i initial.bin] [-f flash.bin] [-o flash.bin] [-q] -u dir
+ *       Serves UART0-2 as Unix sockets in dir, like bl_emulate.py does in
+ *       /embsec, so fw_update.py --uart-dir dir talks to the bootloader.
+ *       Bytes written to UART2 reach the bootloader's debug console (or
+ *       its second frame link while striping), and its output comes back.
+ *       Runs until the UART1 client disconnects.
+ *
+ *   -m session (either mode) leaves a firmware update request in the SRAM
+ *       mailbox first, so the bootloader skips the banner and goes straight
+ *       into update mode, as after bl_request_update() (see mailbox.h).
+ *
+ *   bl_host -b N
+ *       Times N rounds of frame decrypt, hash and page program.
+ *
+ *   bl_host -z N [-s seed] script.bin
+ *       Runs N randomly mutated copies of the script from the same starting
+ *       flash. Build with SANITIZE=1 to catch memory errors.
+ */
+
+// Library Imports
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Application Imports
+#include "crypto.h"
+#include "mailbox.h"
+#include "sim.h"
+
+// Reboots allowed per script before giving up
+#define SIM_MAX_BOOTS 64
+
+// From bootloader.c
+long program_flash(uint32_t page_addr, unsigned char *data, unsigned int data_len);
+
+static uint8_t *read_file(const char *path, uint32_t *len){
+    FILE *fp = fopen(path, "rb");
+    if (!fp){
+        perror(path);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    uint8_t *buf = malloc(size > 0 ? size : 1);
+    if (fread(buf, 1, size, fp) != (size_t)size){
+        perror(path);
+        exit(1);
+    }
+    fclose(fp);
+    *len = size;
+    return buf;
+}
+
+static void write_file(const char *path, const uint8_t *data, uint32_t len){
+    FILE *fp = fopen(path, "wb");
+    if (!fp || fwrite(data, 1, len, fp) != len){
+        perror(path);
+        exit(1);
+    }
+    fclose(fp);
+}
+
+static double now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Runs the bootloader until the script is consumed. Returns the last exit code.
+static int run_script(const uint8_t *data, uint32_t len){
+    int code = SIM_EXIT_IDLE;
+
+    sim_set_script(data, len);
+    for (int boots = 0; boots < SIM_MAX_BOOTS; boots++){
+        code = sim_run();
+        // A socket client decides itself when it is done
+        if (code != SIM_EXIT_RESET || (data && sim_script_remaining() == 0)){
+            break;
+        }
+    }
+    return code;
+}
+
+// Listens on dir/UART0-2 and accepts one client on each, in order, the
+// way QEMU does. Hands UART1 and UART2 to the HAL.
+static void serve_uarts(const char *dir){
+    int conns[3];
+
+    for (int i = 0; i < 3; i++){
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/UART%d", dir, i);
+        unlink(addr.sun_path);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0){
+            perror(addr.sun_path);
+            exit(1);
+        }
+        conns[i] = accept(fd, NULL, NULL);
+        close(fd);
+        unlink(addr.sun_path);
+        if (conns[i] < 0){
+            perror("accept");
+            exit(1);
+        }
+    }
+    // UART0 input is not used
+    close(conns[0]);
+    sim_set_uart1_socket(conns[1]);
+    sim_set_uart2_socket(conns[2]);
+}
+
+static void bench(int rounds){
+    static uint8_t frame[1056];
+    uint8_t key[16] = {0};
+    uint8_t iv[16];
+    uint8_t md[32];
+    double t;
+
+    for (int i = 0; i < (int)sizeof(frame); i++){
+        frame[i] = i;
+    }
+
+    printf("Crypto self test: %s\n", crypto_selftest() == 0 ? "PASS" : "FAIL");
+
+    t = now_us();
+    for (int r = 0; r < rounds; r++){
+        memset(iv, 0, sizeof(iv));
+        bl_aes128_cbc_decrypt(key, iv, frame, sizeof(frame));
+    }
+    printf("decrypt 1056B: %8.2f us/frame\n", (now_us() - t) / rounds);
+
+    t = now_us();
+    for (int r = 0; r < rounds; r++){
+        bl_sha256(frame, 1024, md);
+    }
+    printf("sha256  1024B: %8.2f us/frame\n", (now_us() - t) / rounds);
+
+    t = now_us();
+    for (int r = 0; r < rounds; r++){
+        program_flash(0x10000 + (r % 64) * SIM_FLASH_PAGESIZE, frame, 1024);
+    }
+    printf("program 1024B: %8.2f us/page\n", (now_us() - t) / rounds);
+}
+
+static void fuzz(const uint8_t *base, uint32_t len, int iterations, unsigned seed){
+    static uint8_t start_flash[SIM_FLASH_SIZE];
+    uint8_t *buf = malloc(len + 64);
+    int counts[4] = {0};
+
+    memcpy(start_flash, sim_flash, SIM_FLASH_SIZE);
+    srand(seed);
+
+    for (int it = 0; it < iterations; it++){
+        uint32_t n = len;
+        memcpy(buf, base, len);
+
+        // A few byte flips, sometimes a truncation or an inserted byte
+        int flips = 1 + rand() % 8;
+        for (int f = 0; f < flips && n; f++){
+            buf[rand() % n] ^= 1 << (rand() % 8);
+        }
+        switch (rand() % 4){
+        case 0:
+            n = n ? rand() % n : 0;
+            break;
+        case 1:
+            if (n){
+                uint32_t at = rand() % n;
+                memmove(buf + at + 1, buf + at, n - at);
+                buf[at] = rand();
+                n++;
+            }
+            break;
+        }
+
+        memcpy(sim_flash, start_flash, SIM_FLASH_SIZE);
+        counts[run_script(buf, n)]++;
+    }
+
+    printf("fuzz: %d runs, %d reset, %d boot, %d idle\n", iterations,
+           counts[SIM_EXIT_RESET], counts[SIM_EXIT_BOOT], counts[SIM_EXIT_IDLE]);
+    free(buf);
+}
+
+// Leaves an update request in the mailbox, as the firmware does before
+// resetting (see mailbox.h)
+static void request_update(uint32_t session){
+    sim_mailbox[MAILBOX_MAGIC_WORD] = MAILBOX_MAGIC;
+    sim_mailbox[MAILBOX_COMMAND_WORD] = MAILBOX_UPDATE;
+    sim_mailbox[MAILBOX_ARG_WORD] = session;
+    sim_mailbox[MAILBOX_CHECK_WORD] = ~(MAILBOX_MAGIC ^ MAILBOX_UPDATE ^ session);
+}
+
+static void usage(const char *prog){
+    fprintf(stderr,
+            "usage: %s [-i initial.bin] [-f flash.bin] [-o flash.bin] [-t tx.bin] [-q] [-m session] script.bin\n"
+            "       %s [-i initial.bin] [-f flash.bin] [-o flash.bin] [-q] [-m session] -u dir\n"
+            "       %s -b rounds\n"
+            "       %s -z iterations [-s seed] script.bin\n",
+            prog, prog, prog, prog);
+    exit(2);
+}
+
+int main(int argc, char **argv){
+    const char *flash_in = NULL, *flash_out = NULL, *tx_path = NULL, *uart_dir = NULL;
+    int bench_rounds = 0, fuzz_runs = 0;
+    unsigned seed = 1;
+    int opt;
+
+    memset(sim_flash, 0xFF, SIM_FLASH_SIZE);
+
+    while ((opt = getopt(argc, argv, "i:f:o:t:qb:z:s:u:m:")) != -1){
+        uint32_t len;
+        uint8_t *initial;
+        switch (opt){
+        case 'i':
+            initial = read_file(optarg, &len);
+            sim_set_initial_firmware(initial, len);
+            break;
+        case 'f': flash_in = optarg; break;
+        case 'o': flash_out = optarg; break;
+        case 't': tx_path = optarg; break;
+        case 'q': sim_set_quiet(1); break;
+        case 'b': bench_rounds = atoi(optarg); break;
+        case 'z': fuzz_runs = atoi(optarg); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        case 'u': uart_dir = optarg; break;
+        case 'm': request_update(strtoul(optarg, NULL, 0)); break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (bench_rounds > 0){
+        bench(bench_rounds);
+        return 0;
+    }
+    if (optind != argc - (uart_dir ? 0 : 1)){
+        usage(argv[0]);
+    }
+
+    if (flash_in){
+        uint32_t len;
+        uint8_t *image = read_file(flash_in, &len);
+        memcpy(sim_flash, image, len < SIM_FLASH_SIZE ? len : SIM_FLASH_SIZE);
+        free(image);
+    }
+
+    if (uart_dir){
+        serve_uarts(uart_dir);
+    }
+
+    uint32_t script_len = 0;
+    uint8_t *script = uart_dir ? NULL : read_file(argv[optind], &script_len);
+
+    if (fuzz_runs > 0){
+        sim_set_quiet(1);
+        fuzz(script, script_len, fuzz_runs, seed);
+        free(script);
+        return 0;
+    }
+
+    FILE *tx = tx_path ? fopen(tx_path, "wb") : NULL;
+    sim_set_tx(tx);
+
+    double t = now_us();
+    int code = run_script(script, script_len);
+    t = now_us() - t;
+
+    free(script);
+    if (tx){
+        fclose(tx);
+    }
+    if (flash_out){
+        write_file(flash_out, sim_flash, SIM_FLASH_SIZE);
+    }
+
+    fprintf(stderr, "\n[bl_host] exit=%s time=%.0fus erases=%u words=%u rx=%u timeouts=%u\n",
+            code == SIM_EXIT_BOOT ? "boot" : code == SIM_EXIT_RESET ? "reset" : "idle",
+            t, sim_counters.erases, sim_counters.words_programmed,
+            sim_counters.rx_bytes, sim_counters.rx_timeouts);
+    return 0;
+}
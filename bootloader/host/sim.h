@@ -0,0 +1,52 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Simulated LM3S6965 flash
+#define SIM_FLASH_SIZE 0x40000
+#define SIM_FLASH_PAGESIZE 1024
+
+// Why a bootloader run ended
+#define SIM_EXIT_RESET 1 // hal_reset()
+#define SIM_EXIT_BOOT 2  // hal_boot()
+#define SIM_EXIT_IDLE 3  // Waiting forever with no script left
+
+typedef struct {
+    uint32_t erases;
+    uint32_t words_programmed;
+    uint32_t program_errors;
+    uint32_t rx_bytes;
+    uint32_t rx_timeouts;
+} sim_stats;
+
+extern uint8_t sim_flash[SIM_FLASH_SIZE];
+extern sim_stats sim_counters;
+
+// SRAM mailbox returned by hal_mailbox(); survives between sim_run() calls
+#define SIM_MAILBOX_WORDS 4
+extern volatile uint32_t sim_mailbox[SIM_MAILBOX_WORDS];
+
+// Scripted UART1 input and captured UART1 output
+void sim_set_script(const uint8_t *data, uint32_t len);
+uint32_t sim_script_remaining(void);
+void sim_set_tx(FILE *tx);
+
+// UART1 on a connected socket instead of the script, and UART2 input
+// from a socket
+void sim_set_uart1_socket(int fd);
+void sim_set_uart2_socket(int fd);
+void sim_set_quiet(int quiet);
+
+// Embedded initial firmware returned by hal_initial_firmware()
+void sim_set_initial_firmware(uint8_t *data, uint32_t len);
+
+// Runs the bootloader from reset until it resets, boots or idles.
+// Returns one of the SIM_EXIT_* codes.
+int sim_run(void);
+
+#endif
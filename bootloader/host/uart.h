@@ -0,0 +1,23 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#ifndef HOST_UART_H
+#define HOST_UART_H
+
+#include <stdint.h>
+
+/*
+ * Host stand-in for the write side of the Stellaris UART library.
+ * Reads go through hal_event_wait(); see hal_host.c.
+ */
+
+#define UART0 0
+#define UART1 1
+#define UART2 2
+
+void uart_write(uint8_t uart, uint32_t data);
+void uart_write_str(uint8_t uart, char *str);
+void uart_write_hex(uint8_t uart, uint32_t data);
+void nl(uint8_t uart);
+
+#endif
@@ -0,0 +1,91 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+// Hardware Imports
+#include "inc/hw_types.h"
+
+// Library Imports
+#include <string.h>
+
+// Application Imports
+#include "uart.h"
+#include "crypto.h"
+#include "rx.h" // clock_cycles()
+#include "bench.h"
+
+// One DATA frame: 1024 bytes of payload plus the 32 byte hash
+#define BENCH_FRAME_LEN 1056
+#define BENCH_HASH_LEN 1024
+#define BENCH_ROUNDS 8
+
+static uint8_t bench_buf[BENCH_FRAME_LEN];
+
+typedef void (*cbc_fn)(const uint8_t *, uint8_t *, uint8_t *, uint32_t);
+typedef void (*hash_fn)(const uint8_t *, uint32_t, uint8_t *);
+
+static void sha256_m3_oneshot(const uint8_t *data, uint32_t len, uint8_t *out){
+    sha256_m3_context ctx;
+
+    sha256_m3_init(&ctx);
+    sha256_m3_update(&ctx, data, len);
+    sha256_m3_out(&ctx, out);
+}
+
+// Average cycles to decrypt one frame
+static uint32_t bench_cbc(cbc_fn fn){
+    static const uint8_t key[16] = {0};
+    uint8_t iv[16];
+    uint32_t total = 0;
+
+    for (int r = 0; r < BENCH_ROUNDS; r++){
+        memset(iv, 0, sizeof(iv));
+        uint32_t start = clock_cycles();
+        fn(key, iv, bench_buf, BENCH_FRAME_LEN);
+        total += clock_cycles() - start;
+    }
+    return total / BENCH_ROUNDS;
+}
+
+// Average cycles to hash one frame payload
+static uint32_t bench_hash(hash_fn fn){
+    uint8_t out[32];
+    uint32_t total = 0;
+
+    for (int r = 0; r < BENCH_ROUNDS; r++){
+        uint32_t start = clock_cycles();
+        fn(bench_buf, BENCH_HASH_LEN, out);
+        total += clock_cycles() - start;
+    }
+    return total / BENCH_ROUNDS;
+}
+
+static void bench_line(uint8_t uart, char *name, uint32_t br, uint32_t m3){
+    uart_write_str(uart, name);
+    uart_write_str(uart, " BearSSL: ");
+    uart_write_hex(uart, br);
+    uart_write_str(uart, " M3: ");
+    uart_write_hex(uart, m3);
+    nl(uart);
+}
+
+/* ****************************************************************
+ *
+ * Prints the known answer test result and the average cycles per
+ * frame for each crypto backend.
+ *
+ * \param uart is the UART the report is written to.
+ *
+ * ****************************************************************
+ */
+void crypto_bench(uint8_t uart){
+    for (int i = 0; i < BENCH_FRAME_LEN; i++){
+        bench_buf[i] = i;
+    }
+
+    uart_write_str(uart, "Crypto self test: ");
+    uart_write_str(uart, crypto_selftest() == 0 ? "PASS\n" : "FAIL\n");
+
+    uart_write_str(uart, "Cycles per frame (hex)\n");
+    bench_line(uart, "AES-128 CBC 1056B", bench_cbc(aes128_br_cbc_decrypt), bench_cbc(aes128_m3_cbc_decrypt));
+    bench_line(uart, "SHA-256     1024B", bench_hash(sha256_br), bench_hash(sha256_m3_oneshot));
+}
@@ -0,0 +1,13 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// Runs the crypto known answer tests and prints per-frame cycle counts
+// for BearSSL and the M3 kernels to the given UART. Only built with BENCH=1.
+void crypto_bench(uint8_t uart);
+
+#endif
@@ -1,42 +1,43 @@
 // Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
 // Approved for public release. Distribution unlimited 23-02181-13.
 
-// Hardware Imports
-#include "inc/hw_memmap.h" // Peripheral Base Addresses
-#include "inc/lm3s6965.h"  // Peripheral Bit Masks and Registers
-#include "inc/hw_types.h"  // Boolean type
-#include "inc/hw_ints.h"   // Interrupt numbers
-
-// Driver API Imports
-#include "driverlib/flash.h"     // FLASH API
-#include "driverlib/sysctl.h"    // System control API (clock/reset)
-#include "driverlib/interrupt.h" // Interrupt API
-
 // Library Imports
 #include <string.h>
-#include <bearssl.h> // Crypto library
 
 // Application Imports
 #include "uart.h"
+#include "hal.h"    // Flash, UART receive events, reset and boot (target or host)
+#include "crypto.h" // AES/SHA backend, selected at build time
+#include "frame.h"   // Frame receiver
+#include "journal.h" // Install records in the metadata page
+#include "lz.h"      // Compressed initial firmware
+#include "mailbox.h" // Update requests from the firmware
+#ifdef BL_BENCH
+#include "bench.h"
+#endif
 #include "../keys.h" // Key/AAD stored here
 
 // Forward Declarations
 void load_initial_firmware(void);
-void load_firmware(void);
+void initial_flush(uint32_t offset, uint8_t *data, uint32_t len);
+void update_event(hal_event *ev);
+uint32_t update_wait_ms(void);
+uint8_t update_inputs(void);
+void update_begin(void);
+void update_report(uint8_t uart);
+void manifest_begin(uint8_t *start);
+void manifest_frame(void);
+void manifest_complete(void);
+void manifest_data_frame(uint8_t uart);
+void data_ack(uint8_t uart);
+void update_frame(void);
 void boot_firmware(void);
-int uart_read_bytes(int bytes, uint8_t* dest);
-int frame_decrypt(uint8_t *arr, int expected_type);
+int verify_image(void);
+int bundle_layout(uint8_t *start);
+uint32_t page_location(uint32_t index, uint32_t *addr);
 long program_flash(uint32_t, unsigned char *, unsigned int);
-
-// Firmware Constants
-#define METADATA_BASE 0xFC00 // base address of version and firmware size in Flash
-#define FW_BASE 0x10000      // base address of firmware in Flash
-#define FW_VERSION_ADDRESS (uint16_t *)METADATA_BASE;
-#define FW_SIZE_ADDRESS (uint16_t *)(METADATA_BASE + 2);
-
-// FLASH Constants
-#define FLASH_PAGESIZE 1024
-#define FLASH_WRITESIZE 4
+uint16_t read_u16(uint8_t *p);
+uint32_t read_u32(uint8_t *p);
 
 // Protocol Constants
 #define OK ((unsigned char)0x00)
@@ -45,11 +46,106 @@ long program_flash(uint32_t, unsigned char *, unsigned int);
 #define TYPE ((unsigned char)0x04)
 #define UPDATE ((unsigned char)'U')
 #define BOOT ((unsigned char)'B')
-
-// Firmware v2 is embedded in bootloader
-// Read up on these symbols in the objcopy man page (if you want)!
-extern int _binary_firmware_bin_start;
-extern int _binary_firmware_bin_size;
+#define BENCH ((unsigned char)'T')
+#define STATUS ((unsigned char)'?') // On UART2: print the update state and timings
+#define STRIPE ((unsigned char)'S') // On UART2 during a manifest update: carry DATA frames too
+
+// Frame Constants
+#define START_FRAME 1
+#define DATA_FRAME 2
+#define END_FRAME 3
+#define MANIFEST_FRAME 4       // Frame type carrying page leaves
+#define START_MIN_LEN 6        // Version, firmware size and release message size
+
+// Manifest Constants
+#define MANIFEST_MAGIC 0x544E464D // "MFNT" at START_MAGIC_OFFSET in the START frame
+#define START_MAGIC_OFFSET 6
+#define START_PAGES_OFFSET 10
+#define START_ROOT_OFFSET 12
+#define MAX_PAGES 128          // Pages in one manifest, over all regions
+#define LEAVES_PER_FRAME 32
+
+// Bundle Constants
+#define BUNDLE_MAGIC 0x4C444E42    // "BNDL": a manifest followed by a component table
+#define START_COMPONENTS_OFFSET 44 // Component count, then one entry per component
+#define COMPONENT_ENTRY_LEN 3      // Region id (1 byte) and size (2 bytes)
+#define REGION_APP 0               // Firmware and release message at FW_BASE
+#define REGION_COUNT (1 + JOURNAL_REGIONS)
+
+// Fixed flash regions an update may write, by region id:
+// application, calibration (8 KB) and data (16 KB)
+const uint32_t region_base[REGION_COUNT] = {FW_BASE, 0x30000, 0x32000};
+const uint32_t region_limit[REGION_COUNT] = {MAX_PAGES * FLASH_PAGESIZE, 0x2000, 0x4000};
+
+// Image bytes in each region for the manifest being received (or verified at boot)
+uint32_t region_len[REGION_COUNT];
+
+// Page hashes of the manifest being received (or verified at boot)
+uint8_t manifest_leaves[MAX_PAGES][32];
+uint8_t pages_needed[MAX_PAGES / 8];
+
+// Update states, in the order an update passes through them
+#define UPDATE_IDLE 0     // Waiting for a command
+#define UPDATE_START 1    // Receiving the START frame
+#define UPDATE_MANIFEST 2 // Receiving MANIFEST frames
+#define UPDATE_DATA 3     // Receiving DATA frames and programming their pages
+#define UPDATE_COMMIT 4   // Writing the journal record
+#define UPDATE_END 5      // Receiving the END frame
+#define UPDATE_STATES 6
+
+char *const update_state_names[UPDATE_STATES] = {"IDLE", "START", "MANIFEST", "DATA", "COMMIT", "END"};
+
+// Flash job stages
+#define FLASH_IDLE 0
+#define FLASH_ERASE 1
+#define FLASH_PROGRAM 2
+
+// Bytes programmed per main loop pass, so input is never kept waiting
+// for a whole page
+#define FLASH_SLICE 256
+
+// The update in progress
+typedef struct {
+    uint8_t state;            // UPDATE_*
+    uint8_t manifest;         // Pages are checked against manifest_leaves
+    int error_counter;        // Errors on the current frame
+    uint32_t deadline;        // hal_clock_ms() by which the next byte is due
+
+    // From the START frame
+    uint16_t version;
+    uint16_t f_size;
+    uint16_t r_size;
+    uint32_t page_count;      // Pages over all regions
+    uint8_t root[32];         // Manifest root
+
+    uint32_t manifest_frames; // MANIFEST frames received
+    uint32_t page;            // Page being programmed, by index
+    uint32_t remaining;       // Pages still to program
+
+    // Striped transfer: UART2 carries DATA frames alongside UART1
+    uint8_t stripe;           // UART2 is a frame link
+    int stripe_errors;        // Errors on UART2's current frame
+    uint32_t stripe_deadline; // hal_clock_ms() by which UART2's next byte is due
+    uint32_t stripe_pages;    // Pages that came over UART2
+    uint8_t held;             // HAL_INPUT() of each link holding a frame for the flash
+
+    // Page being programmed from a frame buffer
+    uint8_t flash_stage;      // FLASH_*
+    uint8_t flash_uart;       // Link whose frame buffer it is
+    uint32_t flash_addr;
+    uint32_t flash_len;       // Image bytes in the page
+    uint32_t flash_pos;       // Bytes programmed so far
+
+    // Time in each state. Every frame starts a new visit.
+    uint32_t entered;         // hal_clock_ms() at the start of this visit
+    uint32_t state_visits[UPDATE_STATES];
+    uint32_t state_ms[UPDATE_STATES];
+    uint32_t state_max_ms[UPDATE_STATES];
+} update_session;
+
+update_session update;
+frame_rx rx;        // UART1
+frame_rx stripe_rx; // UART2, while striping
 
 // Device metadata
 
@@ -69,37 +165,38 @@ int main(void){
 
     // A 'reset' on UART0 will re-start this code at the top of main, won't clear flash, but will clean ram.
 
-    // Initialize UART channels
-    // 0: Reset
-    // 1: Host Connection
-    // 2: Debug
-    uart_init(UART0);
-    uart_init(UART1);
-    uart_init(UART2);
-
-    // Enable UART0 interrupt
-    IntEnable(INT_UART0);
-    IntMasterEnable();
+    // Initialize UARTs (0: Reset, 1: Host Connection, 2: Debug) and interrupts
+    hal_init();
+    journal_init();
 
     load_initial_firmware(); // note the short-circuit behavior in this function, it doesn't finish running on reset!
 
-    uart_write_str(UART2, "\nWelcome to the BWSI Vehicle Update Service!\n");
-    uart_write_str(UART2, "Send \"U\" to update, and \"B\" to run the firmware.\n");
-    uart_write_str(UART2, "Writing 0x20 to UART0 will reset the device.\n");
+    // Start idle. The host build runs main() again without clearing RAM.
+    memset(&update, 0, sizeof(update));
+    update.entered = hal_clock_ms();
+    update.state_visits[UPDATE_IDLE] = 1;
+
+    // The firmware asked for an update before resetting: skip the banner
+    // and the wait for 'U', and tell the host we are ready
+    uint32_t session;
+    if (mailbox_take(&session) == MAILBOX_UPDATE){
+        uart_write_str(UART2, "\nUpdate requested by firmware, session ");
+        uart_write_hex(UART2, session);
+        nl(UART2);
+        update_begin();
+    } else {
+        uart_write_str(UART2, "\nWelcome to the BWSI Vehicle Update Service!\n");
+        uart_write_str(UART2, "Send \"U\" to update, and \"B\" to run the firmware.\n");
+        uart_write_str(UART2, "Writing 0x20 to UART0 will reset the device.\n");
+    }
 
-    // Boots or downloads new firmware based on user response
-    int resp;
+    // Every byte received, timeout and piece of finished work is an event
+    // for the update state machine. The core sleeps in hal_event_wait()
+    // while there is nothing to do.
+    hal_event ev;
     while (1){
-        uint32_t instruction = uart_read(UART1, BLOCKING, &resp);
-        if (instruction == UPDATE){
-            uart_write_str(UART1, "U");
-            load_firmware();
-            uart_write_str(UART2, "Loaded new firmware.\n");
-            nl(UART2);
-        }else if (instruction == BOOT){
-            uart_write_str(UART1, "B");
-            boot_firmware();
-        }
+        hal_event_wait(update_wait_ms(), update_inputs(), &ev);
+        update_event(&ev);
     }
 }
 
@@ -112,391 +209,1117 @@ int main(void){
  */
 void load_initial_firmware(void){
 
-    if (*((uint32_t *)(METADATA_BASE)) != 0xFFFFFFFF){
+    if (journal_latest() != NULL){
         /*
-         * Default Flash startup state is all FF since. Only load initial
-         * firmware when metadata page is all FF. Thus, exit if there has
-         * been a reset!
+         * Default Flash startup state is all FF. Only load initial
+         * firmware when the journal has no record yet. Thus, exit if
+         * there has been a reset!
          */
         return;
     }
 
-    // Create buffers for saving the release message
-    uint8_t temp_buf[FLASH_PAGESIZE];
+    // Page buffer, shared by the image and the release message after it
+    uint8_t page[FLASH_PAGESIZE];
     char initial_msg[] = "This is the initial release message.";
     uint16_t msg_len = strlen(initial_msg) + 1;
-    uint16_t rem_msg_bytes;
+    lz_output out = {hal_flash_addr(FW_BASE), page, FLASH_PAGESIZE, 0, initial_flush};
 
     // Get included initial firmware
-    int size = (int)&_binary_firmware_bin_size;
-    uint8_t *initial_data = (uint8_t *)&_binary_firmware_bin_start;
+    uint32_t blob_len;
+    uint8_t *blob = hal_initial_firmware(&blob_len);
 
-    // Set version 2 and install
+    // Install as version 2. The journal record is written last, so an
+    // interrupted first boot installs again.
     uint16_t version = 2;
-    uint32_t metadata = (((uint16_t)size & 0xFFFF) << 16) | (version & 0xFFFF);
-    program_flash(METADATA_BASE, (uint8_t *)(&metadata), 4);
-
-    int i;
 
-    for (i = 0; i < size / FLASH_PAGESIZE; i++){
-        program_flash(FW_BASE + (i * FLASH_PAGESIZE), initial_data + (i * FLASH_PAGESIZE), FLASH_PAGESIZE);
+    // bl_build.py embeds the image compressed. Anything without the
+    // LZ header is copied as is.
+    uint32_t size = lz_size(blob, blob_len);
+    if (size != 0){
+        // The journal stores 16 bit sizes
+        if (size > 0xFFFF || lz_unpack(&out, blob, blob_len) != 0){
+            uart_write_str(UART2, "Initial firmware is corrupt\n");
+            return;
+        }
+    } else {
+        size = blob_len;
+        for (uint32_t i = 0; i < size; i++){
+            lz_put(&out, blob[i]);
+        }
     }
 
-    /* At end of firmware. Since the last page may be incomplete, we copy the initial
-     * release message into the unused space in the last page. If the firmware fully
-     * uses the last page, the release message simply is written to a new page.
+    /* The release message follows the firmware directly, so it shares the
+     * last firmware page when it fits and continues on a new page if not.
      */
+    for (int i = 0; i < msg_len; i++){
+        lz_put(&out, initial_msg[i]);
+    }
+    lz_finish(&out);
 
-    uint16_t rem_fw_bytes = size % FLASH_PAGESIZE;
-    if (rem_fw_bytes == 0){
-        // No firmware left. Just write the release message
-        program_flash(FW_BASE + (i * FLASH_PAGESIZE), (uint8_t *)initial_msg, msg_len);
-    }else{
-        // Some firmware left. Determine how many bytes of release message can fit
-        if (msg_len > (FLASH_PAGESIZE - rem_fw_bytes)){
-            rem_msg_bytes = msg_len - (FLASH_PAGESIZE - rem_fw_bytes);
-        }else{
-            rem_msg_bytes = 0;
-        }
-
-        // Copy rest of firmware
-        memcpy(temp_buf, initial_data + (i * FLASH_PAGESIZE), rem_fw_bytes);
-        // Copy what will fit of the release message
-        memcpy(temp_buf + rem_fw_bytes, initial_msg, msg_len - rem_msg_bytes);
-        // Program the final firmware and first part of the release message
-        program_flash(FW_BASE + (i * FLASH_PAGESIZE), temp_buf, rem_fw_bytes + (msg_len - rem_msg_bytes));
-
-        // If there are more bytes, program them directly from the release message string
-        if (rem_msg_bytes > 0){
-            // Writing to a new page. Increment pointer
-            i++;
-            program_flash(FW_BASE + (i * FLASH_PAGESIZE), (uint8_t *)(initial_msg + (msg_len - rem_msg_bytes)), rem_msg_bytes);
-        }
+    if (journal_commit(version, size, msg_len, NULL, NULL) != 0){
+        uart_write_str(UART2, "Initial firmware metadata write failed\n");
     }
 }
 
 
-/*
+/* ****************************************************************
+ *
+ * Programs one page of initial firmware as it is unpacked
+ *
+ * \param offset is the position of the page in the image.
+ *
+ * ****************************************************************
+ */
+void initial_flush(uint32_t offset, uint8_t *data, uint32_t len){
+    program_flash(FW_BASE + offset, data, len);
+}
+
+/* ****************************************************************
+ *
+ * Reads a little endian 16/32 bit value from a byte buffer
+ *
+ * ****************************************************************
+ */
+uint16_t read_u16(uint8_t *p){
+    return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+uint32_t read_u32(uint8_t *p){
+    return (uint32_t)read_u16(p) | ((uint32_t)read_u16(p + 2) << 16);
+}
+
+/* ****************************************************************
+ *
+ * Sends END and resets after too many errors on one frame
+ *
  * ****************************************************************
- * Reads a given number of bytes from UART1
- * 
- * \param bytes is the number of bytes to be read
- * \param dest is where to write them
+ */
+void abort_update(void){
+    uart_write_str(UART2, "Timeout: too many errors\n");
+    uart_write(UART1, TYPE);
+    uart_write(UART1, END);
+    hal_reset();
+}
+
+/* ****************************************************************
+ *
+ * Number of image bytes stored in a page
+ *
+ * \param index is the page number from FW_BASE.
+ * \param total_size is the firmware plus release message size.
  *
- * \return Returns 0 if reading successful, 1 if not
  * ****************************************************************
  */
-int uart_read_bytes(int bytes, uint8_t* dest){
-    int rcv = 0;//Received data
-    int read = 0; //Flag that reports on success of read operation
-    int result = 0;//Stores operation status
-    for (int i = 0; i < bytes; i += 1) {
-        rcv = uart_read(UART1, BLOCKING, &read);
-        dest[i] = rcv;
-        if (read != 0){
-            result = 1;
+uint32_t page_length(uint32_t index, uint32_t total_size){
+    uint32_t offset = index * FLASH_PAGESIZE;
+    return (total_size - offset < FLASH_PAGESIZE) ? total_size - offset : FLASH_PAGESIZE;
+}
+
+/* ****************************************************************
+ *
+ * Hashes the page leaves into the manifest root
+ *
+ * \param leaves is page_count 32 byte page hashes.
+ * \param page_count is the number of pages.
+ * \param root receives the 32 byte root.
+ *
+ * ****************************************************************
+ */
+void manifest_root(uint8_t *leaves, uint32_t page_count, uint8_t *root){
+    bl_sha256(leaves, page_count * 32, root);
+}
+
+/* ****************************************************************
+ *
+ * Finds the flash page behind a manifest page index. Pages are
+ * numbered through the regions in order, as sized by region_len.
+ *
+ * \param index is the page number in the manifest.
+ * \param addr receives the flash address of the page.
+ *
+ * \return Returns the number of image bytes in the page, or 0 if the
+ * index is past the last page
+ *
+ * ****************************************************************
+ */
+uint32_t page_location(uint32_t index, uint32_t *addr){
+    for (int r = 0; r < REGION_COUNT; r++){
+        uint32_t pages = (region_len[r] + FLASH_PAGESIZE - 1) / FLASH_PAGESIZE;
+        if (index < pages){
+            *addr = region_base[r] + index * FLASH_PAGESIZE;
+            return page_length(index, region_len[r]);
         }
+        index -= pages;
     }
-    return result;
+    return 0;
 }
 
 /* ****************************************************************
  *
- * Reads and decrypts a packet as well as checking its HASH.
+ * Reads the component table of a bundle START frame into
+ * region_len. Each component names a fixed region by id, so the
+ * host never chooses flash addresses.
+ *
+ * \param start is the decrypted START frame.
+ *
+ * \return Returns 0 if the table is valid, or 1 if a region is
+ * unknown, repeated, empty or too large
  *
- * \param arr is the array that unencrypted data will be written to.
- * 
- * \return Returns a 0 on success, or a 1 if the GHASH was invalid.
- * 
  * ****************************************************************
  */
-int frame_decrypt(uint8_t *arr, int expected_type){
-    // Misc vars for reading
-    int read = 0;
-    uint32_t rcv = 0;
-    int error = 0;
+int bundle_layout(uint8_t *start){
+    uint8_t count = start[START_COMPONENTS_OFFSET];
+    uint8_t *entry = start + START_COMPONENTS_OFFSET + 1;
 
-    uint8_t encrypted[1056];
-    uint8_t iv[16];
+    if (count > REGION_COUNT - 1){
+        return 1;
+    }
+    for (int i = 0; i < count; i++, entry += COMPONENT_ENTRY_LEN){
+        uint8_t region = entry[0];
+        uint16_t size = read_u16(entry + 1);
 
-    unsigned char gen_hash[32];
+        if (region == REGION_APP || region >= REGION_COUNT || region_len[region] != 0 ||
+            size == 0 || size > region_limit[region]){
+            return 1;
+        }
+        region_len[region] = size;
+    }
+    return 0;
+}
+/* ****************************************************************
+ *
+ * Update state machine
+ *
+ * An update goes IDLE, START, [MANIFEST,] DATA, COMMIT, END and back
+ * to IDLE. Nothing here blocks: each call handles one event and
+ * returns to the main loop.
+ *
+ * - RX: a byte on UART1 goes to the frame receiver (or is a command
+ *   in IDLE), a byte on UART2 is a debug console command, or goes to
+ *   the second frame receiver while striping.
+ * - Timer: no input right now. Pending work (programming the next
+ *   flash slice, the journal commit) is done one step at a time, so
+ *   input never waits behind a page. With nothing pending it is the
+ *   frame timeout, once the deadline has passed.
+ *
+ * The frame receiver decrypts while a frame is still arriving (see
+ * frame.h).
+ * - Flash: the last slice of a page is programmed.
+ *
+ * The host sends a frame only after the previous one was answered,
+ * so a link is not read while a page is programmed from its frame
+ * buffer. A frame that comes in on the other link meanwhile is held
+ * until the flash is free.
+ *
+ * ****************************************************************
+ */
+
+// Ends the current visit of a state and starts one of the given state
+void update_enter(uint8_t state){
+    uint32_t now = hal_clock_ms();
+    uint32_t spent = now - update.entered;
 
-    // Zero out the generated hash array
-    for (int c = 0; c < 32; c++){
-        gen_hash[c] = 0;
+    update.state_ms[update.state] += spent;
+    if (spent > update.state_max_ms[update.state]){
+        update.state_max_ms[update.state] = spent;
     }
+    update.state = state;
+    update.entered = now;
+    update.state_visits[state]++;
+}
+
+// Enters a state that receives frames of the given type
+void update_expect(uint8_t state, uint8_t frame_type){
+    update_enter(state);
+    frame_rx_start(&rx, KEY, frame_type);
+    update.deadline = hal_clock_ms() + RX_FRAME_TIMEOUT_MS;
+}
 
-    // Read and check TYPE
-    if (uart_read(UART1, BLOCKING, &read) != (int) expected_type){
-        error = 1;
-        return error;
+// Answers a frame with OK and waits for the next one
+void update_ack(void){
+    uart_write(UART1, TYPE);
+    uart_write(UART1, OK);
+    update.error_counter = 0;
+    update.deadline = hal_clock_ms() + RX_FRAME_TIMEOUT_MS;
+}
+
+/* ****************************************************************
+ *
+ * Rejects the current frame with ERROR so the host sends it again,
+ * and gives up after more than 10 errors in a row
+ *
+ * \param msg is the reason, for UART2.
+ *
+ * ****************************************************************
+ */
+void frame_error(char *msg){
+    uart_write_str(UART2, msg);
+    uart_write(UART1, TYPE);
+    uart_write(UART1, ERROR);
+
+    frame_rx_start(&rx, KEY, rx.expected_type);
+    update.deadline = hal_clock_ms() + RX_FRAME_TIMEOUT_MS;
+
+    update.error_counter++;
+    if (update.error_counter > 10){
+        abort_update();
     }
+}
 
-    // Reads DATA and HASH
-    for (int i = 0; i < 1056; i += 1) {
-        rcv = uart_read(UART1, BLOCKING, &read);
-        encrypted[i] = rcv;
+// Message for a bad or missing frame in the current state
+char *frame_error_message(void){
+    if (update.state == UPDATE_MANIFEST || update.state == UPDATE_END){
+        return "Incorrect Hash or Type\n";
     }
-    // Reads IV
-    for (int i = 0; i < 16; i += 1) {
-        rcv = uart_read(UART1, BLOCKING, &read);
-        iv[i] = rcv;
+    if (update.state == UPDATE_DATA && update.manifest){
+        return "Incorrect Page, Hash or Type\n";
     }
+    return "Incorrect Hash, Type or Length\n";
+}
 
-    // Unencrypt w/ CBC
-    const br_block_cbcdec_class* vd = &br_aes_big_cbcdec_vtable;
-    br_aes_gen_cbcdec_keys v_dc;
-    const br_block_cbcdec_class **dc;
-    dc = &v_dc.vtable;
-    vd->init(dc, KEY, 16);
-    vd->run(dc, iv, encrypted, 1056);
+/* ****************************************************************
+ *
+ * Striped transfer
+ *
+ * During a manifest update the host may send DATA frames over UART2
+ * as well as UART1. Each frame names its page, so either link can
+ * carry any page and every page is programmed at its own address,
+ * whichever link or order it arrives in. Nothing is committed until
+ * all pages are in, as with a single link.
+ *
+ * Each link has its own frame buffer, and its frames are answered on
+ * that link, so each keeps its own send-and-wait flow control. UART2
+ * still carries debug text; the TYPE byte of a response never
+ * appears in it. After more than 10 errors in a row UART2 alone is
+ * dropped with END and the host sends the rest over UART1.
+ *
+ * ****************************************************************
+ */
+
+// Frame receiver of a link
+frame_rx *link_rx(uint8_t uart){
+    return uart == UART2 ? &stripe_rx : &rx;
+}
+
+// Whether a link's frame buffer holds a frame for the flash
+int link_busy(uint8_t uart){
+    return (update.held & HAL_INPUT(uart)) ||
+           (update.flash_stage != FLASH_IDLE && update.flash_uart == uart);
+}
+
+// Answers a UART2 frame with OK
+void stripe_ack(void){
+    uart_write(UART2, TYPE);
+    uart_write(UART2, OK);
+    update.stripe_errors = 0;
+    update.deadline = hal_clock_ms() + RX_FRAME_TIMEOUT_MS;
+}
 
-    // Put unencrypted firmware into output array
-    for (int i = 0; i < 1024; i += 1) {
-        arr[i] = encrypted[i];
+// Rejects the UART2 frame, and drops the link after more than 10
+// errors in a row
+void stripe_error(char *msg){
+    uart_write_str(UART2, msg);
+    uart_write(UART2, TYPE);
+    uart_write(UART2, ERROR);
+    frame_rx_start(&stripe_rx, KEY, DATA_FRAME);
+    update.deadline = hal_clock_ms() + RX_FRAME_TIMEOUT_MS;
+
+    update.stripe_errors++;
+    if (update.stripe_errors > 10){
+        uart_write_str(UART2, "Striped link dropped, UART1 only\n");
+        uart_write(UART2, TYPE);
+        uart_write(UART2, END);
+        update.stripe = 0;
     }
+}
 
-    // Init hash variables
-    br_sha256_context ctx;
-    int owo = sizeof(br_sha256_context);
-    for (int uwu = 0; uwu < owo; uwu++){
-        ((uint8_t *)&ctx)[uwu] = 0;
+// Answers a frame on the link it came in on
+void link_ack(uint8_t uart){
+    if (uart == UART2){
+        stripe_ack();
+    } else {
+        update_ack();
     }
-    // Generate HASH
-    br_sha256_init(&ctx); // Initialize SHA256 context
-    br_sha256_update(&ctx, arr, 1024); // Update context with data
-    br_sha256_out(&ctx, gen_hash);
+}
 
-    // Compare new HASH to old HASH
-    for (int i = 0; i < 32; i += 1) {
-        if (gen_hash[i] != encrypted[1024 + i]){
-            error = 1;
-        }
+// Rejects a frame on the link it came in on
+void link_error(uint8_t uart, char *msg){
+    if (uart == UART2){
+        stripe_error(msg);
+    } else {
+        frame_error(msg);
     }
+}
 
-    return error;
+/* ****************************************************************
+ *
+ * Handles the STRIPE command on UART2: makes UART2 a second link for
+ * DATA frames. Only a manifest update that is receiving DATA frames
+ * can be striped.
+ *
+ * Answers OK on UART2, or ERROR if the update can't be striped.
+ *
+ * ****************************************************************
+ */
+void stripe_join(void){
+    if (update.state != UPDATE_DATA || !update.manifest){
+        uart_write(UART2, TYPE);
+        uart_write(UART2, ERROR);
+        return;
+    }
+    uart_write_str(UART2, "Striping DATA frames over UART1 and UART2\n");
+    update.stripe = 1;
+    frame_rx_start(&stripe_rx, KEY, DATA_FRAME);
+    stripe_ack();
+}
+
+// Handles a finished UART2 frame
+void stripe_frame(void){
+    frame_rx_finish(&stripe_rx);
+    manifest_data_frame(UART2);
+}
+
+// Feeds a UART2 byte to the second frame receiver
+void stripe_rx_byte(uint8_t byte){
+    // Progress on either link keeps UART1 from timing out while the
+    // host waits on UART2
+    update.stripe_deadline = hal_clock_ms() + RX_FRAME_TIMEOUT_MS;
+    update.deadline = update.stripe_deadline;
+
+    int result = frame_rx_byte(&stripe_rx, byte);
+    if (result == FRAME_BAD){
+        stripe_error(frame_error_message());
+    } else if (result == FRAME_READY){
+        if (update.flash_stage != FLASH_IDLE){
+            update.held |= HAL_INPUT(UART2);
+        } else {
+            stripe_frame();
+        }
+    }
 }
 
 /* ****************************************************************
  *
- * Recieves and decrypts all frames using frame_decrypt()
- * 
- * Writes start firmware metadata, firmware data, and release message
- * to flash
- * 
+ * Acknowledges update mode with 'U' on UART1 and waits for the START
+ * frame
+ *
  * ****************************************************************
  */
-void load_firmware(void){
+void update_begin(void){
+    uart_write_str(UART1, "U");
     uart_write_str(UART2, "\nUpdate started\n");
+    update.error_counter = 0;
+    update.stripe = 0;
+    update.stripe_pages = 0;
+    update.held = 0;
+    update_expect(UPDATE_START, START_FRAME);
+}
 
-    int error = 0;              // stores frame_decrypt return
-    int error_counter = 0;
+/* ****************************************************************
+ *
+ * Returns to IDLE after the END frame and reports the result on
+ * UART2
+ *
+ * ****************************************************************
+ */
+void update_finish(void){
+    update_enter(UPDATE_IDLE);
+    uart_write_str(UART2, "Loaded new firmware.\n");
+    hal_stats_report(UART2);
+    journal_report(UART2);
+    update_report(UART2);
+    nl(UART2);
+}
 
-    uint32_t data_index = 0;            // Length of current data chunk written to flash
-    uint32_t page_addr = FW_BASE;   // Address to write to in flash
+/* ****************************************************************
+ *
+ * Prints the current state and, per state, the visits, the total
+ * time and the longest visit in ms
+ *
+ * ****************************************************************
+ */
+void update_report(uint8_t uart){
+    uart_write_str(uart, "State: ");
+    uart_write_str(uart, update_state_names[update.state]);
+    nl(uart);
+    for (int s = 0; s < UPDATE_STATES; s++){
+        uart_write_str(uart, update_state_names[s]);
+        uart_write_str(uart, ": visits ");
+        uart_write_hex(uart, update.state_visits[s]);
+        uart_write_str(uart, ", ms ");
+        uart_write_hex(uart, update.state_ms[s]);
+        uart_write_str(uart, ", longest ");
+        uart_write_hex(uart, update.state_max_ms[s]);
+        nl(uart);
+    }
+    uart_write_str(uart, "Pages over UART2: ");
+    uart_write_hex(uart, update.stripe_pages);
+    nl(uart);
+}
 
-    // variables to store data from START frame
-    uint16_t version;
-    uint16_t f_size;
-    uint16_t r_size;
+/* ****************************************************************
+ *
+ * Starts programming a page from a link's frame buffer. Bytes after
+ * the image in the last word are left erased.
+ *
+ * \param uart is the link the frame came in on.
+ * \param addr is the page address.
+ * \param len is the number of image bytes in the page.
+ *
+ * ****************************************************************
+ */
+void flash_start(uint8_t uart, uint32_t addr, uint32_t len){
+    uint8_t *data = link_rx(uart)->plain;
+
+    memset(data + len, 0xFF, ((len + FLASH_WRITESIZE - 1) & ~(FLASH_WRITESIZE - 1)) - len);
+    update.flash_uart = uart;
+    update.flash_addr = addr;
+    update.flash_len = len;
+    update.flash_pos = 0;
+    update.flash_stage = FLASH_ERASE;
+}
 
-    // Firmware Buffer
-    unsigned char complete_data[1024];
-    // ************************************************************
-    // Read START frame and checks for errors
-    do {
-        // Read frame
-        error = frame_decrypt(complete_data, 1);
-
-        // Get version (0x2)
-        version = (uint16_t)complete_data[0];
-        version |= (uint16_t)complete_data[1] << 8;
-        uart_write_str(UART2, "Received Firmware Version: ");
-        uart_write_hex(UART2, version);
-        nl(UART2);
-        // Get release message size in bytes (0x2)
-        f_size = (uint16_t)complete_data[2];
-        f_size |= (uint16_t)complete_data[3] << 8;
-        uart_write_str(UART2, "Received Firmware Size: ");
-        uart_write_hex(UART2, f_size);
+/* ****************************************************************
+ *
+ * Handles the flash event of a finished page: on success marks the
+ * page as done and acknowledges the frame, otherwise asks for the
+ * frame again
+ *
+ * \param error is 0 if the page was programmed and reads back.
+ *
+ * ****************************************************************
+ */
+void page_programmed(int error){
+    uint8_t uart = update.flash_uart;
+
+    if (error){
+        link_error(uart, "Error while writing\n");
+        return;
+    }
+
+    if (update.manifest){
+        pages_needed[update.page / 8] &= ~(1 << (update.page % 8));
+        uart_write_str(UART2, "Page programmed: ");
+        uart_write_hex(UART2, update.page);
         nl(UART2);
-        // Get firmware size in bytes (0x2) 
-        r_size = (uint16_t)complete_data[4];
-        r_size |= (uint16_t)complete_data[5] << 8;
-        uart_write_str(UART2, "Received Release Message Size: ");
-        uart_write_hex(UART2, r_size);
+        if (uart == UART2){
+            update.stripe_pages++;
+        }
+    } else {
+        // Write success and debugging messages to UART2.
+        uart_write_str(UART2, "Page successfully programmed\nAddress: ");
+        uart_write_hex(UART2, update.flash_addr);
+        uart_write_str(UART2, "\nBytes: ");
+        uart_write_hex(UART2, update.flash_len);
         nl(UART2);
+        update.page++;
+    }
+    update.remaining--;
+    data_ack(uart);
+}
 
-        // Get version metadata
-        uint16_t old_version = *FW_VERSION_ADDRESS;
-        // If version 0 (debug), don't change version
-        if (version == 0){
-            version = old_version;
-        }
+/* ****************************************************************
+ *
+ * Answers a DATA frame that has been dealt with, and moves on to
+ * COMMIT once every page is in and no frame is still held
+ *
+ * \param uart is the link the frame came in on.
+ *
+ * ****************************************************************
+ */
+void data_ack(uint8_t uart){
+    link_ack(uart);
+    if (update.remaining == 0 && update.held == 0){
+        update_enter(UPDATE_COMMIT);
+    } else if (uart == UART1){
+        update_expect(UPDATE_DATA, DATA_FRAME);
+    }
+}
 
-        // Check for HASH error
-        if (error == 1){
-            uart_write_str(UART2, "Incorrect Hash or Type\n");
-        // If version less than old version, reject and reset
-        } else if ((version < old_version)){
-            uart_write_str(UART2, "Incorrect Version\n");
-            error = 1;
+/* ****************************************************************
+ *
+ * Does one step of the flash job: the erase, or the next FLASH_SLICE
+ * bytes. Raises the flash event after the last one.
+ *
+ * ****************************************************************
+ */
+void flash_step(void){
+    uint8_t *data = link_rx(update.flash_uart)->plain;
+    uint32_t total = (update.flash_len + FLASH_WRITESIZE - 1) & ~(FLASH_WRITESIZE - 1);
+    uint32_t n = total - update.flash_pos;
+
+    if (update.flash_stage == FLASH_ERASE){
+        update.flash_stage = FLASH_PROGRAM;
+        journal_note_erase(update.flash_addr);
+        if (hal_flash_erase(update.flash_addr) != 0){
+            update.flash_stage = FLASH_IDLE;
+            page_programmed(1);
         }
+        return;
+    }
 
-        // Reject metadata if any error
-        if (error == 1){
-            uart_write(UART1, TYPE);
-            uart_write(UART1, ERROR);
-        }
+    if (n > FLASH_SLICE){
+        n = FLASH_SLICE;
+    }
+    if (n > 0 && hal_flash_program((uint32_t *)(data + update.flash_pos),
+                                   update.flash_addr + update.flash_pos, n) != 0){
+        update.flash_stage = FLASH_IDLE;
+        page_programmed(1);
+        return;
+    }
+    update.flash_pos += n;
 
-        // Implements error timeout
-        // If 10+ errors for a single frame, end by returning out of method
-        error_counter += error;
-        if (error_counter > 10) {
-            uart_write_str(UART2, "Timeout: too many errors\n");
-            uart_write(UART1, TYPE);
-            uart_write(UART1, END);
-            SysCtlReset();
-            return;
-        }
-    } while (error != 0);
+    if (update.flash_pos == total){
+        update.flash_stage = FLASH_IDLE;
+        page_programmed(memcmp(data, hal_flash_addr(update.flash_addr), update.flash_len) != 0);
+    }
+}
 
-    // Resets counter, since start frame successful
-    error_counter = 0;
+/* ****************************************************************
+ *
+ * Writes the journal record once every page is in place. A manifest
+ * update commits every component at once, with the root as image
+ * digest. If the record cannot be written the update is aborted.
+ *
+ * ****************************************************************
+ */
+void update_commit(void){
+    int error;
 
-    // Write metadata to flash (firmware size and version) 
-    // Version is at lower address, size is at higher address
-    uint32_t metadata = ((f_size & 0xFFFF) << 16) | (version & 0xFFFF);
-    program_flash(METADATA_BASE, (uint8_t *)(&metadata), 4);
+    if (update.manifest){
+        uint16_t sizes[JOURNAL_REGIONS];
+        for (int r = 1; r < REGION_COUNT; r++){
+            sizes[r - 1] = region_len[r];
+        }
+        error = journal_commit(update.version, update.f_size, update.r_size, sizes, update.root);
+    } else {
+        error = journal_commit(update.version, update.f_size, update.r_size, NULL, NULL);
+    }
 
-    // Acknowledge the metadata.
+    // Without its record the image is not installed, so END is never acknowledged
+    if (error){
+        uart_write_str(UART2, "Metadata write failed\n");
+        abort_update();
+        return;
+    }
     uart_write_str(UART2, "Metadata written to flash\n");
-    uart_write(UART1, TYPE);
-    uart_write(UART1, OK);
 
-    // ************************************************************
-    // Process DATA frames
-    int total_size = f_size + r_size;
-    for (int i = 0; i < total_size; i += 1024){
-        // Reading and checking for errors
-        do {
-            // Read frame
-            error = frame_decrypt(complete_data, 2);
-
-            // Error handling
-            if (error == 1){
-                uart_write_str(UART2, "Incorrect Hash or Type\n");
-                uart_write(UART1, TYPE);
-                uart_write(UART1, ERROR);
-            }
-
-            // Error timeout implementation
-            error_counter += error;
-            if(error_counter > 10){
-                uart_write_str(UART2, "Timeout: too many errors\n");
-                uart_write(UART1, TYPE);
-                uart_write(UART1, END);
-                SysCtlReset();
-                return;
-            }
-
-        } while (error != 0);
-
-        // Write that packet has been recieved
-        uart_write_str(UART2, "Recieved bytes at ");
-        uart_write_hex(UART2, i);
-        nl(UART2);
+    // Only UART1 carries the END frame; UART2 is the console again
+    update.stripe = 0;
+    update_expect(UPDATE_END, END_FRAME);
+}
 
-        if (total_size - i < FLASH_PAGESIZE) {
-            data_index = total_size - i;
-        } else {
-            data_index = FLASH_PAGESIZE;
-        }
+/* ****************************************************************
+ *
+ * Handles the START frame: checks it and the version, then sets up a
+ * plain or a manifest update
+ *
+ * ****************************************************************
+ */
+void start_frame(void){
+    uint8_t *start = rx.plain;
 
-        // Writing to flash
-        do {
-            // Write to flash, then check if data and memory match
-            if (program_flash(page_addr, complete_data, data_index) == -1){
-                uart_write_str(UART2, "Error while writing\n");
-                uart_write(UART1, TYPE);
-                uart_write(UART1, ERROR);
-                error = 1;
-            } else if (memcmp(complete_data, (void *) page_addr, data_index) != 0){
-                uart_write_str(UART2, "Error while writing\n");
-                uart_write(UART1, TYPE);
-                uart_write(UART1, ERROR);
-                error = 1;
-            }
-                    
-            // Error timeout
-            error_counter += error;
-            if (error_counter > 10){
-                uart_write_str(UART2, "Timeout: too many errors\n");
-                uart_write(UART1, TYPE);
-                uart_write(UART1, END);
-                SysCtlReset();
-                return;
-            }
-        } while(error != 0);
+    // The frame must at least hold the sizes
+    int error = frame_check_hash(&rx) != 0 || rx.header.len < START_MIN_LEN;
 
-        // Write success and debugging messages to UART2.
-        uart_write_str(UART2, "Page successfully programmed\nAddress: ");
-        uart_write_hex(UART2, page_addr);
-        uart_write_str(UART2, "\nBytes: ");
-        uart_write_hex(UART2, data_index);
-        nl(UART2);
+    // Get version (0x2)
+    update.version = read_u16(start);
+    uart_write_str(UART2, "Received Firmware Version: ");
+    uart_write_hex(UART2, update.version);
+    nl(UART2);
+    // Get firmware size in bytes (0x2)
+    update.f_size = read_u16(start + 2);
+    uart_write_str(UART2, "Received Firmware Size: ");
+    uart_write_hex(UART2, update.f_size);
+    nl(UART2);
+    // Get release message size in bytes (0x2)
+    update.r_size = read_u16(start + 4);
+    uart_write_str(UART2, "Received Release Message Size: ");
+    uart_write_hex(UART2, update.r_size);
+    nl(UART2);
+
+    // Get version metadata
+    journal_record *record = journal_latest();
+    uint16_t old_version = record ? record->version : 0;
+    // If version 0 (debug), don't change version
+    if (update.version == 0){
+        update.version = old_version;
+    }
 
-        // Update to next page
-        page_addr += FLASH_PAGESIZE;
-        data_index = 0;
+    if (error){
+        frame_error(frame_error_message());
+        return;
+    }
+    // If version less than old version, reject
+    if (update.version < old_version){
+        frame_error("Incorrect Version\n");
+        return;
+    }
 
+    // A manifest (or bundle) in the START frame switches to hash-checked pages in any order
+    uint32_t magic = read_u32(start + START_MAGIC_OFFSET);
+    if (magic == MANIFEST_MAGIC || magic == BUNDLE_MAGIC){
+        manifest_begin(start);
+        return;
+    }
 
-        // Send packet recieved success message
-        uart_write(UART1, TYPE);
-        uart_write(UART1, OK);
-        
-        // Reset counter inbetween packets
-        error_counter = 0;
-    }
-
-    // ************************************************************
-    // Process END frame
-    do {
-        // Read frame
-        error = frame_decrypt(complete_data, 3);
-            
-        // Error handling
-        if (error == 1){
-            uart_write_str(UART2, "Incorrect Hash or Type\n");
-            uart_write(UART1, TYPE);
-            uart_write(UART1, ERROR);
-        }
+    // Plain update: DATA frames in page order. Acknowledge the metadata;
+    // it is committed once every page is in.
+    uint32_t total_size = update.f_size + update.r_size;
+    update.manifest = 0;
+    update.page = 0;
+    update.remaining = (total_size + FLASH_PAGESIZE - 1) / FLASH_PAGESIZE;
+
+    uart_write_str(UART2, "Metadata accepted\n");
+    update_ack();
+    if (update.remaining == 0){
+        update_enter(UPDATE_COMMIT);
+    } else {
+        update_expect(UPDATE_DATA, DATA_FRAME);
+    }
+}
 
-        // Error timeout implementation
-        error_counter += error;
-        if(error_counter > 10){
-            uart_write_str(UART2, "Timeout: too many errors\n");
-            uart_write(UART1, TYPE);
-            uart_write(UART1, END);
-            SysCtlReset();
-            return;
-        }
+/* ****************************************************************
+ *
+ * Handles a DATA frame of a plain update, which carries the next
+ * page. Only the tail frame may be shorter than a page.
+ *
+ * ****************************************************************
+ */
+void data_frame(void){
+    uint32_t total_size = update.f_size + update.r_size;
+    uint32_t length = page_length(update.page, total_size);
+
+    if (frame_check_hash(&rx) != 0 || rx.header.len < length){
+        frame_error(frame_error_message());
+        return;
+    }
+
+    // Write that packet has been recieved
+    uart_write_str(UART2, "Recieved bytes at ");
+    uart_write_hex(UART2, update.page * FLASH_PAGESIZE);
+    nl(UART2);
+
+    flash_start(UART1, FW_BASE + update.page * FLASH_PAGESIZE, length);
+}
 
-    } while (error != 0);
+/* ****************************************************************
+ *
+ * Handles the END frame and finishes the update
+ *
+ * ****************************************************************
+ */
+void end_frame(void){
+    if (frame_check_hash(&rx) != 0){
+        frame_error(frame_error_message());
+        return;
+    }
 
     uart_write_str(UART2, "End frame processed\n\n(ﾉ◕ヮ◕)ﾉ*:･ﾟ✧\n");
 
     // End return
-    uart_write(UART1, TYPE);
-    uart_write(UART1, OK);
-    
+    update_ack();
+
     uart_write_str(UART2, "Received Firmware Version: ");
-    uart_write_hex(UART2, version);
+    uart_write_hex(UART2, update.version);
     uart_write_str(UART2, "Received Release Message Size: ");
-    uart_write_hex(UART2, r_size);
+    uart_write_hex(UART2, update.r_size);
     uart_write_str(UART2, "Received Firmware Size: ");
-    uart_write_hex(UART2, f_size);
-    return;
+    uart_write_hex(UART2, update.f_size);
+
+    update_finish();
+}
+
+/* ****************************************************************
+ *
+ * Handles a command byte on UART1 while idle
+ *
+ * ****************************************************************
+ */
+void update_command(uint8_t instruction){
+    if (instruction == UPDATE){
+        update_begin();
+    }else if (instruction == BOOT){
+        uart_write_str(UART1, "B");
+        hal_stats_report(UART2);
+        boot_firmware();
+#ifdef BL_BENCH
+    }else if (instruction == BENCH){
+        uart_write_str(UART1, "T");
+        crypto_bench(UART2);
+#endif
+    }
+}
+
+/* ****************************************************************
+ *
+ * Feeds a UART1 byte to the frame receiver and handles the frame it
+ * completes, or holds it while the flash is busy with a UART2 frame
+ *
+ * ****************************************************************
+ */
+void update_rx(uint8_t byte){
+    update.deadline = hal_clock_ms() + RX_FRAME_TIMEOUT_MS;
+
+    int result = frame_rx_byte(&rx, byte);
+    if (result == FRAME_BAD){
+        frame_error(frame_error_message());
+    } else if (result == FRAME_READY){
+        if (update.flash_stage != FLASH_IDLE){
+            update.held |= HAL_INPUT(UART1);
+        } else {
+            update_frame();
+        }
+    }
+}
+
+// Handles a finished UART1 frame in the current state
+void update_frame(void){
+    frame_rx_finish(&rx);
+    switch (update.state){
+    case UPDATE_START:
+        start_frame();
+        break;
+    case UPDATE_MANIFEST:
+        manifest_frame();
+        break;
+    case UPDATE_DATA:
+        if (update.manifest){
+            manifest_data_frame(UART1);
+        } else {
+            data_frame();
+        }
+        break;
+    case UPDATE_END:
+        end_frame();
+        break;
+    }
+}
+
+// Handles a frame that was held while the flash was busy
+void update_held(void){
+    if (update.held & HAL_INPUT(UART1)){
+        update.held &= ~HAL_INPUT(UART1);
+        update_frame();
+    } else {
+        update.held &= ~HAL_INPUT(UART2);
+        stripe_frame();
+    }
+}
+
+// Whether UART1's deadline applies. While striping, UART1 may wait for
+// a UART2 frame in progress, which has a deadline of its own. With
+// neither link in a frame it runs as usual, so an abandoned striped
+// session still times out.
+int update_timed(void){
+    return update.state != UPDATE_IDLE &&
+           (!update.stripe || frame_rx_started(&rx) || !frame_rx_started(&stripe_rx));
+}
+
+/* ****************************************************************
+ *
+ * Handles a timer event: does the next step of pending work, or
+ * rejects the frame in progress on a link whose deadline has passed
+ *
+ * ****************************************************************
+ */
+void update_timer(void){
+    uint32_t now = hal_clock_ms();
+
+    if (update.flash_stage != FLASH_IDLE){
+        flash_step();
+    } else if (update.held){
+        update_held();
+    } else if (update.state == UPDATE_COMMIT){
+        update_commit();
+    } else if (update.stripe && frame_rx_started(&stripe_rx) && (int32_t)(now - update.stripe_deadline) >= 0){
+        stripe_error(frame_error_message());
+    } else if (update_timed() && (int32_t)(now - update.deadline) >= 0){
+        frame_error(frame_error_message());
+    }
+}
+
+/* ****************************************************************
+ *
+ * Dispatches one event from the main loop
+ *
+ * ****************************************************************
+ */
+void update_event(hal_event *ev){
+    if (ev->type == HAL_EVENT_TIMER){
+        update_timer();
+    } else if (ev->uart == UART2){
+        if (update.stripe){
+            stripe_rx_byte(ev->byte);
+        } else if (ev->byte == STATUS){
+            update_report(UART2);
+        } else if (ev->byte == STRIPE){
+            stripe_join();
+        }
+    } else if (update.state == UPDATE_IDLE){
+        update_command(ev->byte);
+    } else {
+        update_rx(ev->byte);
+    }
+}
+
+/* ****************************************************************
+ *
+ * How long the main loop may sleep: not at all with work pending,
+ * until the earliest frame deadline during an update, and
+ * indefinitely when idle
+ *
+ * ****************************************************************
+ */
+uint32_t update_wait_ms(void){
+    uint32_t now = hal_clock_ms();
+    uint32_t wait = RX_FOREVER;
+
+    if (update.flash_stage != FLASH_IDLE || update.held || update.state == UPDATE_COMMIT){
+        return 0;
+    }
+    if (update_timed()){
+        int32_t left = (int32_t)(update.deadline - now);
+        wait = left > 0 ? (uint32_t)left : 0;
+    }
+    if (update.stripe && frame_rx_started(&stripe_rx)){
+        int32_t left = (int32_t)(update.stripe_deadline - now);
+        if (left <= 0){
+            wait = 0;
+        } else if ((uint32_t)left < wait){
+            wait = left;
+        }
+    }
+    return wait;
+}
+
+// UARTs the main loop reads: a link waits while a page from its frame
+// buffer is being written, and UART1 while the journal is
+uint8_t update_inputs(void){
+    uint8_t inputs = 0;
+
+    if (update.state != UPDATE_COMMIT && !link_busy(UART1)){
+        inputs |= HAL_INPUT(UART1);
+    }
+    if (!link_busy(UART2)){
+        inputs |= HAL_INPUT(UART2);
+    }
+    return inputs;
+}
+
+/* ****************************************************************
+ *
+ * Sets up a manifest update from its START frame.
+ *
+ * The START frame carries the page count and the root hash of the
+ * page leaf list. The list follows in MANIFEST frames and is checked
+ * against the root once. After that each DATA frame names its page
+ * in the trailer and is accepted when its hash matches that page's
+ * leaf, so frames may arrive in any order. Pages already in flash
+ * that match their leaf are skipped, and the host is told which
+ * pages it still has to send, over one link or striped over two.
+ * Metadata, including the root as the image digest, is written only
+ * once every page is in place.
+ *
+ * A bundle START frame adds a component table. Its pages follow the
+ * application pages in the same manifest, so every component is
+ * transferred in one session and committed by the same journal
+ * record.
+ *
+ * \param start is the decrypted START frame.
+ *
+ * ****************************************************************
+ */
+void manifest_begin(uint8_t *start){
+    uint32_t total_size = update.f_size + update.r_size;
+
+    update.manifest = 1;
+    update.page_count = read_u16(start + START_PAGES_OFFSET);
+    update.manifest_frames = 0;
+    memcpy(update.root, start + START_ROOT_OFFSET, 32);
+
+    memset(region_len, 0, sizeof(region_len));
+    region_len[REGION_APP] = total_size;
+    if (read_u32(start + START_MAGIC_OFFSET) == BUNDLE_MAGIC && bundle_layout(start) != 0){
+        uart_write_str(UART2, "Bad component table\n");
+        abort_update();
+        return;
+    }
+
+    // The page count has to describe exactly the announced sizes
+    uint32_t layout_pages = 0;
+    for (int r = 0; r < REGION_COUNT; r++){
+        layout_pages += (region_len[r] + FLASH_PAGESIZE - 1) / FLASH_PAGESIZE;
+    }
+    if (update.page_count > MAX_PAGES || update.page_count != layout_pages){
+        uart_write_str(UART2, "Bad page count\n");
+        abort_update();
+        return;
+    }
+
+    update_ack();
+    if (update.page_count == 0){
+        manifest_complete();
+    } else {
+        update_expect(UPDATE_MANIFEST, MANIFEST_FRAME);
+    }
+}
+
+/* ****************************************************************
+ *
+ * Handles a MANIFEST frame. The last one is answered after the root
+ * check, in manifest_complete().
+ *
+ * ****************************************************************
+ */
+void manifest_frame(void){
+    uint32_t frames = (update.page_count + LEAVES_PER_FRAME - 1) / LEAVES_PER_FRAME;
+
+    if (frame_check_hash(&rx) != 0){
+        frame_error(frame_error_message());
+        return;
+    }
+
+    uint32_t first = update.manifest_frames * LEAVES_PER_FRAME;
+    uint32_t count = (update.page_count - first < LEAVES_PER_FRAME) ? update.page_count - first : LEAVES_PER_FRAME;
+    memcpy(manifest_leaves[first], rx.plain, count * 32);
+    update.manifest_frames++;
+
+    if (update.manifest_frames < frames){
+        update_ack();
+        update_expect(UPDATE_MANIFEST, MANIFEST_FRAME);
+    } else {
+        manifest_complete();
+    }
+}
+
+/* ****************************************************************
+ *
+ * Checks the leaf list against the root, finds the pages that are
+ * not in flash yet and tells the host which ones to send
+ *
+ * ****************************************************************
+ */
+void manifest_complete(void){
+    uint8_t gen_hash[32];
+
+    // One hash authenticates the whole list
+    manifest_root(manifest_leaves[0], update.page_count, gen_hash);
+    if (memcmp(gen_hash, update.root, 32) != 0){
+        uart_write_str(UART2, "Manifest does not match root\n");
+        abort_update();
+        return;
+    }
+
+    // Resume: anything already in flash that matches its leaf is kept
+    update.remaining = 0;
+    memset(pages_needed, 0, sizeof(pages_needed));
+    for (uint32_t i = 0; i < update.page_count; i++){
+        uint32_t page_addr;
+        uint32_t length = page_location(i, &page_addr);
+        bl_sha256(hal_flash_addr(page_addr), length, gen_hash);
+        if (memcmp(gen_hash, manifest_leaves[i], 32) != 0){
+            pages_needed[i / 8] |= 1 << (i % 8);
+            update.remaining++;
+        }
+    }
+    uart_write_str(UART2, "Manifest accepted, pages needed: ");
+    uart_write_hex(UART2, update.remaining);
+    nl(UART2);
+
+    // Acknowledge with the page count and the bitmap of pages the host
+    // still has to send. The count lets a host that streams its frames
+    // read the bitmap without knowing the image size.
+    update_ack();
+    uart_write(UART1, update.page_count & 0xFF);
+    uart_write(UART1, update.page_count >> 8);
+    for (uint32_t i = 0; i < (update.page_count + 7) / 8; i++){
+        uart_write(UART1, pages_needed[i]);
+    }
+
+    if (update.remaining == 0){
+        update_enter(UPDATE_COMMIT);
+    } else {
+        update_expect(UPDATE_DATA, DATA_FRAME);
+    }
+}
+
+/* ****************************************************************
+ *
+ * Handles a DATA frame of a manifest update. The only per-frame check
+ * is one hash against the leaf of the page named in the trailer; it
+ * also covers the length, as anything past it reads as zero.
+ * Duplicates are acknowledged but not programmed twice.
+ *
+ * \param uart is the link the frame came in on.
+ *
+ * ****************************************************************
+ */
+void manifest_data_frame(uint8_t uart){
+    frame_rx *frame = link_rx(uart);
+    uint32_t index = read_u16(frame->plain + FLASH_PAGESIZE);
+    uint32_t length = 0;
+    uint32_t page_addr = 0;
+    uint8_t gen_hash[32];
+    int error = index >= update.page_count;
+
+    if (!error){
+        length = page_location(index, &page_addr);
+        bl_sha256(frame->plain, length, gen_hash);
+        error = memcmp(gen_hash, manifest_leaves[index], 32) != 0;
+    }
+    if (error){
+        link_error(uart, frame_error_message());
+        return;
+    }
+
+    if (pages_needed[index / 8] & (1 << (index % 8))){
+        update.page = index;
+        flash_start(uart, page_addr, length);
+    } else {
+        data_ack(uart);
+    }
+}
+
+/* ****************************************************************
+ *
+ * Checks the installed image, and any bundle regions installed with
+ * it, against the digest stored by a manifest update. Images
+ * installed without a manifest have no digest and always pass.
+ *
+ * \return Returns 0 if the image matches or has no digest, 1 if not
+ *
+ * ****************************************************************
+ */
+int verify_image(void){
+    journal_record *record = journal_latest();
+    uint8_t gen_hash[32];
+
+    if (record == NULL || !(record->flags & JOURNAL_HAS_DIGEST)){
+        return 0;
+    }
+
+    uint32_t page_count = 0;
+    region_len[REGION_APP] = record->fw_size + record->rm_size;
+    for (int r = 1; r < REGION_COUNT; r++){
+        region_len[r] = record->region_sizes[r - 1];
+    }
+    for (int r = 0; r < REGION_COUNT; r++){
+        page_count += (region_len[r] + FLASH_PAGESIZE - 1) / FLASH_PAGESIZE;
+    }
+    if (page_count > MAX_PAGES){
+        return 1;
+    }
+
+    // Rebuild the leaves from flash, then the root
+    for (uint32_t i = 0; i < page_count; i++){
+        uint32_t page_addr;
+        uint32_t length = page_location(i, &page_addr);
+        bl_sha256(hal_flash_addr(page_addr), length, manifest_leaves[i]);
+    }
+    manifest_root(manifest_leaves[0], page_count, gen_hash);
+
+    return memcmp(gen_hash, record->digest, 32) != 0;
 }
 
 /* ****************************************************************
@@ -520,7 +1343,8 @@ long program_flash(uint32_t page_addr, unsigned char *data, unsigned int data_le
     int i;
 
     // Erase next FLASH page
-    FlashErase(page_addr);
+    hal_flash_erase(page_addr);
+    journal_note_erase(page_addr);
 
     // Clear potentially unused bytes in last word
     // If data not a multiple of 4 (word size), program up to the last word
@@ -531,7 +1355,7 @@ long program_flash(uint32_t page_addr, unsigned char *data, unsigned int data_le
         int num_full_bytes = data_len - rem;
 
         // Program up to the last word
-        ret = FlashProgram((unsigned long *)data, page_addr, num_full_bytes);
+        ret = hal_flash_program((uint32_t *)data, page_addr, num_full_bytes);
         if (ret != 0){
             return ret;
         }
@@ -545,10 +1369,10 @@ long program_flash(uint32_t page_addr, unsigned char *data, unsigned int data_le
         }
 
         // Program word
-        return FlashProgram(&word, page_addr + num_full_bytes, 4);
+        return hal_flash_program(&word, page_addr + num_full_bytes, 4);
     }else{
         // Write full buffer of 4-byte words
-        return FlashProgram((unsigned long *)data, page_addr, data_len);
+        return hal_flash_program((uint32_t *)data, page_addr, data_len);
     }
 }
 
@@ -559,15 +1383,27 @@ long program_flash(uint32_t page_addr, unsigned char *data, unsigned int data_le
  * ****************************************************************
  */
 void boot_firmware(void){
+    // Refuse to boot an image that no longer matches its digest
+    if (verify_image() != 0){
+        uart_write_str(UART2, "Image digest mismatch, not booting\n");
+        return;
+    }
+
     // compute the release message address, and then print it
-    uint16_t fw_size = *FW_SIZE_ADDRESS;
-    fw_release_message_address = (uint8_t *)(FW_BASE + fw_size);
-    uart_write_str(UART2, (char *)fw_release_message_address);
+    journal_record *record = journal_latest();
+    if (record == NULL){
+        uart_write_str(UART2, "No firmware installed\n");
+        return;
+    }
+    uint16_t fw_size = record->fw_size;
+    fw_release_message_address = hal_flash_addr(FW_BASE + fw_size);
+    // Bounded, in case an interrupted update never wrote the terminator
+    for (int i = 0; i < FLASH_PAGESIZE && fw_release_message_address[i] != '\0'; i++){
+        uart_write(UART2, fw_release_message_address[i]);
+    }
 
     // Boot the firmware
-    __asm(
-        "LDR R0,=0x10001\n\t"
-        "BX R0\n\t");
+    hal_boot();
 }
 
 /* ****************************************************************
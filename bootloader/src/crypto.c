@@ -0,0 +1,517 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+// Library Imports
+#include <string.h>
+#ifndef BL_NO_BEARSSL
+#include <bearssl.h>
+#endif
+
+// Application Imports
+#include "crypto.h"
+
+/*
+ * The M3 kernels are written for what GCC turns into good Thumb-2: the
+ * rotates fold into the barrel shifter of the following EOR/ADD, table
+ * lookups are a single LDR with a scaled index, and the round loops are
+ * unrolled so the working state stays in registers.
+ *
+ * AES uses one 1KB decryption T-table (the other three are rotations of
+ * it) plus the 256 byte inverse S-box. Both live in SRAM so the lookups
+ * don't compete with instruction fetches on the flash bus. They are built
+ * on first use rather than stored, which keeps them out of the image.
+ */
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL8(x, n) ((uint8_t)(((x) << (n)) | ((x) >> (8 - (n)))))
+
+#define LOAD_LE(p) ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+#define LOAD_BE(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+
+static void store_le(uint8_t *p, uint32_t v){
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void store_be(uint8_t *p, uint32_t v){
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* ****************************************************************
+ *
+ * AES-128 decryption (Cortex-M3)
+ *
+ * ****************************************************************
+ */
+
+static uint32_t aes_td[256] __attribute__((aligned(4)));
+static uint8_t aes_isbox[256] __attribute__((aligned(4)));
+static uint8_t aes_sbox[256];
+static int aes_tables_ready = 0;
+
+// Multiplication by x in GF(2^8)
+static uint8_t xtime(uint8_t a){
+    return (a << 1) ^ ((a & 0x80) ? 0x1B : 0x00);
+}
+
+static uint8_t gmul(uint8_t a, uint8_t b){
+    uint8_t r = 0;
+    while (b){
+        if (b & 1){
+            r ^= a;
+        }
+        a = xtime(a);
+        b >>= 1;
+    }
+    return r;
+}
+
+/*
+ * Builds the S-boxes and the decryption table. Words are little endian
+ * with state row 0 in the low byte, so
+ *   aes_td[x] = 0e*s | 09*s << 8 | 0d*s << 16 | 0b*s << 24, s = isbox[x]
+ * and the table for row r is aes_td rotated left by 8r.
+ */
+static void aes_m3_build_tables(void){
+    uint8_t p = 1, q = 1;
+
+    // Walk the multiplicative group with generator 3 to get inverses
+    do {
+        p = p ^ xtime(p);
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        if (q & 0x80){
+            q ^= 0x09;
+        }
+        uint8_t s = q ^ ROTL8(q, 1) ^ ROTL8(q, 2) ^ ROTL8(q, 3) ^ ROTL8(q, 4) ^ 0x63;
+        aes_sbox[p] = s;
+    } while (p != 1);
+    aes_sbox[0] = 0x63;
+
+    for (int i = 0; i < 256; i++){
+        aes_isbox[aes_sbox[i]] = i;
+    }
+    for (int i = 0; i < 256; i++){
+        uint8_t s = aes_isbox[i];
+        aes_td[i] = (uint32_t)gmul(s, 0x0E)
+            | ((uint32_t)gmul(s, 0x09) << 8)
+            | ((uint32_t)gmul(s, 0x0D) << 16)
+            | ((uint32_t)gmul(s, 0x0B) << 24);
+    }
+    aes_tables_ready = 1;
+}
+
+// InvMixColumns of one column, reusing the decryption table
+static uint32_t aes_inv_mix(uint32_t w){
+    return aes_td[aes_sbox[w & 0xFF]]
+        ^ ROTL(aes_td[aes_sbox[(w >> 8) & 0xFF]], 8)
+        ^ ROTL(aes_td[aes_sbox[(w >> 16) & 0xFF]], 16)
+        ^ ROTL(aes_td[aes_sbox[w >> 24]], 24);
+}
+
+// Expands the key into the 44 word schedule for the equivalent inverse cipher
+static void aes_m3_decrypt_keys(const uint8_t *key, uint32_t *dk){
+    uint32_t ek[44];
+    uint8_t rcon = 1;
+
+    for (int i = 0; i < 4; i++){
+        ek[i] = LOAD_LE(key + 4 * i);
+    }
+    for (int i = 4; i < 44; i++){
+        uint32_t t = ek[i - 1];
+        if ((i & 3) == 0){
+            t = ROTR(t, 8);
+            t = (uint32_t)aes_sbox[t & 0xFF]
+                | ((uint32_t)aes_sbox[(t >> 8) & 0xFF] << 8)
+                | ((uint32_t)aes_sbox[(t >> 16) & 0xFF] << 16)
+                | ((uint32_t)aes_sbox[t >> 24] << 24);
+            t ^= rcon;
+            rcon = xtime(rcon);
+        }
+        ek[i] = ek[i - 4] ^ t;
+    }
+
+    // Round keys in reverse order, middle rounds passed through InvMixColumns
+    for (int r = 0; r <= 10; r++){
+        for (int c = 0; c < 4; c++){
+            uint32_t w = ek[4 * (10 - r) + c];
+            dk[4 * r + c] = (r == 0 || r == 10) ? w : aes_inv_mix(w);
+        }
+    }
+}
+
+#define TD(x) aes_td[(x) & 0xFF]
+#define IROUND(o0, o1, o2, o3, i0, i1, i2, i3, rk)                                           \
+    o0 = TD(i0) ^ ROTL(TD(i3 >> 8), 8) ^ ROTL(TD(i2 >> 16), 16) ^ ROTL(TD(i1 >> 24), 24) ^ (rk)[0]; \
+    o1 = TD(i1) ^ ROTL(TD(i0 >> 8), 8) ^ ROTL(TD(i3 >> 16), 16) ^ ROTL(TD(i2 >> 24), 24) ^ (rk)[1]; \
+    o2 = TD(i2) ^ ROTL(TD(i1 >> 8), 8) ^ ROTL(TD(i0 >> 16), 16) ^ ROTL(TD(i3 >> 24), 24) ^ (rk)[2]; \
+    o3 = TD(i3) ^ ROTL(TD(i2 >> 8), 8) ^ ROTL(TD(i1 >> 16), 16) ^ ROTL(TD(i0 >> 24), 24) ^ (rk)[3];
+#define ISB(x, n) ((uint32_t)aes_isbox[((x) >> (n)) & 0xFF])
+#define ILAST(i0, i1, i2, i3, k) \
+    (ISB(i0, 0) | (ISB(i3, 8) << 8) | (ISB(i2, 16) << 16) | (ISB(i1, 24) << 24)) ^ (k)
+
+// Decrypts one block in place with an expanded decryption schedule
+static void aes_m3_decrypt_block(const uint32_t *dk, uint8_t *block){
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+
+    s0 = LOAD_LE(block) ^ dk[0];
+    s1 = LOAD_LE(block + 4) ^ dk[1];
+    s2 = LOAD_LE(block + 8) ^ dk[2];
+    s3 = LOAD_LE(block + 12) ^ dk[3];
+
+    IROUND(t0, t1, t2, t3, s0, s1, s2, s3, dk + 4);
+    IROUND(s0, s1, s2, s3, t0, t1, t2, t3, dk + 8);
+    IROUND(t0, t1, t2, t3, s0, s1, s2, s3, dk + 12);
+    IROUND(s0, s1, s2, s3, t0, t1, t2, t3, dk + 16);
+    IROUND(t0, t1, t2, t3, s0, s1, s2, s3, dk + 20);
+    IROUND(s0, s1, s2, s3, t0, t1, t2, t3, dk + 24);
+    IROUND(t0, t1, t2, t3, s0, s1, s2, s3, dk + 28);
+    IROUND(s0, s1, s2, s3, t0, t1, t2, t3, dk + 32);
+    IROUND(t0, t1, t2, t3, s0, s1, s2, s3, dk + 36);
+
+    store_le(block, ILAST(t0, t1, t2, t3, dk[40]));
+    store_le(block + 4, ILAST(t1, t2, t3, t0, dk[41]));
+    store_le(block + 8, ILAST(t2, t3, t0, t1, dk[42]));
+    store_le(block + 12, ILAST(t3, t0, t1, t2, dk[43]));
+}
+
+/* ****************************************************************
+ *
+ * Decrypts a buffer in place with AES-128 CBC.
+ *
+ * \param key is the 16 byte key.
+ * \param iv is the 16 byte IV, updated to the last ciphertext block
+ * so consecutive calls chain like BearSSL's run().
+ * \param data is the buffer to decrypt.
+ * \param len is the buffer length, a multiple of 16.
+ *
+ * ****************************************************************
+ */
+void aes128_m3_cbc_decrypt(const uint8_t *key, uint8_t *iv, uint8_t *data, uint32_t len){
+    uint32_t dk[44];
+    uint8_t saved[16];
+
+    if (!aes_tables_ready){
+        aes_m3_build_tables();
+    }
+    aes_m3_decrypt_keys(key, dk);
+
+    for (uint32_t off = 0; off < len; off += 16){
+        uint8_t *block = data + off;
+        memcpy(saved, block, 16);
+        aes_m3_decrypt_block(dk, block);
+        for (int i = 0; i < 16; i++){
+            block[i] ^= iv[i];
+        }
+        memcpy(iv, saved, 16);
+    }
+}
+
+/* ****************************************************************
+ *
+ * SHA-256 (Cortex-M3)
+ *
+ * ****************************************************************
+ */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static const uint32_t sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+#define BSIG0(x) (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define BSIG1(x) (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SSIG0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define SSIG1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+#define CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+
+// Message schedule kept as a 16 word ring, expanded on the fly
+#define W(i) w[(i) & 15]
+#define EXPAND(i) (W(i) += SSIG1(W((i) - 2)) + W((i) - 7) + SSIG0(W((i) - 15)))
+
+// One round; the caller rotates the variable names instead of moving data
+#define SROUND(a, b, c, d, e, f, g, h, i, wi)           \
+    h += BSIG1(e) + CH(e, f, g) + sha256_k[i] + (wi); \
+    d += h;                                           \
+    h += BSIG0(a) + MAJ(a, b, c);
+
+#define SROUND8(i, WX)                             \
+    SROUND(a, b, c, d, e, f, g, h, (i) + 0, WX((i) + 0)) \
+    SROUND(h, a, b, c, d, e, f, g, (i) + 1, WX((i) + 1)) \
+    SROUND(g, h, a, b, c, d, e, f, (i) + 2, WX((i) + 2)) \
+    SROUND(f, g, h, a, b, c, d, e, (i) + 3, WX((i) + 3)) \
+    SROUND(e, f, g, h, a, b, c, d, (i) + 4, WX((i) + 4)) \
+    SROUND(d, e, f, g, h, a, b, c, (i) + 5, WX((i) + 5)) \
+    SROUND(c, d, e, f, g, h, a, b, (i) + 6, WX((i) + 6)) \
+    SROUND(b, c, d, e, f, g, h, a, (i) + 7, WX((i) + 7))
+
+/* ****************************************************************
+ *
+ * Runs the SHA-256 compression function on one 64 byte block.
+ *
+ * \param state is the 8 word chaining value, updated in place.
+ * \param block is the message block.
+ *
+ * ****************************************************************
+ */
+void sha256_m3_compress(uint32_t *state, const uint8_t *block){
+    uint32_t w[16];
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 16; i++){
+        w[i] = LOAD_BE(block + 4 * i);
+    }
+
+    SROUND8(0, W)
+    SROUND8(8, W)
+    for (int i = 16; i < 64; i += 16){
+        SROUND8(i, EXPAND)
+        SROUND8(i + 8, EXPAND)
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+void sha256_m3_init(sha256_m3_context *ctx){
+    memcpy(ctx->state, sha256_iv, sizeof(sha256_iv));
+    ctx->count = 0;
+}
+
+void sha256_m3_update(sha256_m3_context *ctx, const uint8_t *data, uint32_t len){
+    uint32_t used = ctx->count & 63;
+    ctx->count += len;
+
+    // Top up a partial block first
+    if (used){
+        uint32_t take = 64 - used;
+        if (take > len){
+            take = len;
+        }
+        memcpy(ctx->buf + used, data, take);
+        data += take;
+        len -= take;
+        if (used + take < 64){
+            return;
+        }
+        sha256_m3_compress(ctx->state, ctx->buf);
+    }
+
+    // Whole blocks straight from the caller's buffer
+    while (len >= 64){
+        sha256_m3_compress(ctx->state, data);
+        data += 64;
+        len -= 64;
+    }
+    memcpy(ctx->buf, data, len);
+}
+
+void sha256_m3_out(sha256_m3_context *ctx, uint8_t *out){
+    uint32_t used = ctx->count & 63;
+    uint32_t bits = ctx->count << 3;
+
+    ctx->buf[used++] = 0x80;
+    if (used > 56){
+        memset(ctx->buf + used, 0, 64 - used);
+        sha256_m3_compress(ctx->state, ctx->buf);
+        used = 0;
+    }
+    memset(ctx->buf + used, 0, 56 - used);
+    store_be(ctx->buf + 56, ctx->count >> 29);
+    store_be(ctx->buf + 60, bits);
+    sha256_m3_compress(ctx->state, ctx->buf);
+
+    for (int i = 0; i < 8; i++){
+        store_be(out + 4 * i, ctx->state[i]);
+    }
+}
+
+/* ****************************************************************
+ *
+ * BearSSL reference path (what the bootloader used originally).
+ * The host build can leave it out with BL_NO_BEARSSL.
+ *
+ * ****************************************************************
+ */
+#ifndef BL_NO_BEARSSL
+void aes128_br_cbc_decrypt(const uint8_t *key, uint8_t *iv, uint8_t *data, uint32_t len){
+    const br_block_cbcdec_class *vd = &br_aes_big_cbcdec_vtable;
+    br_aes_gen_cbcdec_keys v_dc;
+    const br_block_cbcdec_class **dc = &v_dc.vtable;
+
+    vd->init(dc, key, 16);
+    vd->run(dc, iv, data, len);
+}
+
+void sha256_br(const uint8_t *data, uint32_t len, uint8_t *out){
+    br_sha256_context ctx;
+
+    memset(&ctx, 0, sizeof(ctx));
+    br_sha256_init(&ctx);
+    br_sha256_update(&ctx, data, len);
+    br_sha256_out(&ctx, out);
+}
+#endif
+
+/* ****************************************************************
+ *
+ * Selected backend
+ *
+ * ****************************************************************
+ */
+void bl_aes128_cbc_decrypt(const uint8_t *key, uint8_t *iv, uint8_t *data, uint32_t len){
+#ifdef BL_FAST_CRYPTO
+    aes128_m3_cbc_decrypt(key, iv, data, len);
+#else
+    aes128_br_cbc_decrypt(key, iv, data, len);
+#endif
+}
+
+void bl_sha256(const uint8_t *data, uint32_t len, uint8_t *out){
+    bl_sha256_context ctx;
+
+    bl_sha256_init(&ctx);
+    bl_sha256_update(&ctx, data, len);
+    bl_sha256_out(&ctx, out);
+}
+
+void bl_sha256_init(bl_sha256_context *ctx){
+#ifdef BL_FAST_CRYPTO
+    sha256_m3_init(&ctx->m3);
+#else
+    memset(&ctx->br, 0, sizeof(ctx->br));
+    br_sha256_init(&ctx->br);
+#endif
+}
+
+void bl_sha256_update(bl_sha256_context *ctx, const uint8_t *data, uint32_t len){
+#ifdef BL_FAST_CRYPTO
+    sha256_m3_update(&ctx->m3, data, len);
+#else
+    br_sha256_update(&ctx->br, data, len);
+#endif
+}
+
+void bl_sha256_out(bl_sha256_context *ctx, uint8_t *out){
+#ifdef BL_FAST_CRYPTO
+    sha256_m3_out(&ctx->m3, out);
+#else
+    br_sha256_out(&ctx->br, out);
+#endif
+}
+
+/* ****************************************************************
+ *
+ * Known answer tests
+ *
+ * ****************************************************************
+ */
+
+// FIPS-197 Appendix C.1
+static const uint8_t kat_aes_key[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+static const uint8_t kat_aes_ct[16] = {
+    0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+static const uint8_t kat_aes_pt[16] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+
+// SP 800-38A F.2.2 CBC-AES128.Decrypt
+static const uint8_t kat_cbc_key[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+static const uint8_t kat_cbc_iv[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+static const uint8_t kat_cbc_ct[64] = {
+    0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+    0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+    0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b, 0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+    0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09, 0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7};
+static const uint8_t kat_cbc_pt[64] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+
+// FIPS 180-2 Appendix B.1 and B.2
+static const char kat_sha_msg1[] = "abc";
+static const uint8_t kat_sha_md1[32] = {
+    0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+    0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad};
+static const char kat_sha_msg2[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+static const uint8_t kat_sha_md2[32] = {
+    0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+    0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1};
+
+typedef void (*cbc_fn)(const uint8_t *, uint8_t *, uint8_t *, uint32_t);
+
+static int kat_cbc(cbc_fn fn){
+    uint8_t buf[64];
+    uint8_t iv[16];
+    int error = 0;
+
+    // Single block with a zero IV is the raw cipher
+    memset(iv, 0, 16);
+    memcpy(buf, kat_aes_ct, 16);
+    fn(kat_aes_key, iv, buf, 16);
+    error |= memcmp(buf, kat_aes_pt, 16) != 0;
+
+    memcpy(iv, kat_cbc_iv, 16);
+    memcpy(buf, kat_cbc_ct, 64);
+    fn(kat_cbc_key, iv, buf, 64);
+    error |= memcmp(buf, kat_cbc_pt, 64) != 0;
+    // The IV must be left chained for the next call
+    error |= memcmp(iv, kat_cbc_ct + 48, 16) != 0;
+
+    return error;
+}
+
+static void sha256_m3(const uint8_t *data, uint32_t len, uint8_t *out){
+    sha256_m3_context ctx;
+
+    sha256_m3_init(&ctx);
+    sha256_m3_update(&ctx, data, len);
+    sha256_m3_out(&ctx, out);
+}
+
+int crypto_selftest(void){
+    uint8_t md[32];
+    int error = 0;
+
+    error |= kat_cbc(aes128_m3_cbc_decrypt);
+    sha256_m3((const uint8_t *)kat_sha_msg1, strlen(kat_sha_msg1), md);
+    error |= memcmp(md, kat_sha_md1, 32) != 0;
+    sha256_m3((const uint8_t *)kat_sha_msg2, strlen(kat_sha_msg2), md);
+    error |= memcmp(md, kat_sha_md2, 32) != 0;
+
+#ifndef BL_NO_BEARSSL
+    error |= kat_cbc(aes128_br_cbc_decrypt);
+    sha256_br((const uint8_t *)kat_sha_msg1, strlen(kat_sha_msg1), md);
+    error |= memcmp(md, kat_sha_md1, 32) != 0;
+    sha256_br((const uint8_t *)kat_sha_msg2, strlen(kat_sha_msg2), md);
+    error |= memcmp(md, kat_sha_md2, 32) != 0;
+#endif
+
+    return error;
+}
@@ -0,0 +1,59 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#ifndef CRYPTO_H
+#define CRYPTO_H
+
+#include <stdint.h>
+
+#ifndef BL_FAST_CRYPTO
+#include <bearssl.h>
+#endif
+
+/*
+ * Crypto front end used by the update path.
+ *
+ * Build with CRYPTO=fast (defines BL_FAST_CRYPTO) to route the bl_* calls
+ * to the Cortex-M3 kernels below, otherwise they go to BearSSL. Both
+ * backends are always linked so the benchmark can compare them.
+ */
+
+// Incremental SHA-256 state for the M3 kernel
+typedef struct {
+    uint32_t state[8];
+    uint8_t buf[64];
+    uint32_t count; // Total bytes hashed so far
+} sha256_m3_context;
+
+// Backend-independent incremental SHA-256 state
+typedef struct {
+#ifdef BL_FAST_CRYPTO
+    sha256_m3_context m3;
+#else
+    br_sha256_context br;
+#endif
+} bl_sha256_context;
+
+// Selected backend
+void bl_aes128_cbc_decrypt(const uint8_t *key, uint8_t *iv, uint8_t *data, uint32_t len);
+void bl_sha256(const uint8_t *data, uint32_t len, uint8_t *out);
+void bl_sha256_init(bl_sha256_context *ctx);
+void bl_sha256_update(bl_sha256_context *ctx, const uint8_t *data, uint32_t len);
+void bl_sha256_out(bl_sha256_context *ctx, uint8_t *out);
+
+// Cortex-M3 kernels
+void aes128_m3_cbc_decrypt(const uint8_t *key, uint8_t *iv, uint8_t *data, uint32_t len);
+void sha256_m3_compress(uint32_t *state, const uint8_t *block);
+void sha256_m3_init(sha256_m3_context *ctx);
+void sha256_m3_update(sha256_m3_context *ctx, const uint8_t *data, uint32_t len);
+void sha256_m3_out(sha256_m3_context *ctx, uint8_t *out);
+
+// BearSSL reference path (not in host builds with BL_NO_BEARSSL)
+void aes128_br_cbc_decrypt(const uint8_t *key, uint8_t *iv, uint8_t *data, uint32_t len);
+void sha256_br(const uint8_t *data, uint32_t len, uint8_t *out);
+
+// Runs the FIPS-197, SP 800-38A and FIPS 180-2 known answer tests on every linked backend.
+// Returns 0 if everything matched.
+int crypto_selftest(void);
+
+#endif
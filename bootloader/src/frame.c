@@ -0,0 +1,169 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+// Library Imports
+#include <string.h>
+
+// Application Imports
+#include "crypto.h"
+#include "frame.h"
+
+// Parts of a frame, in order
+#define STAGE_TYPE 0
+#define STAGE_LEN 1
+#define STAGE_BODY 2 // Ciphertext of payload and trailer
+#define STAGE_IV 3
+
+void frame_rx_start(frame_rx *rx, const uint8_t *key, uint8_t expected_type){
+    if (key != rx->key){
+        memcpy(rx->key, key, sizeof(rx->key));
+    }
+    rx->expected_type = expected_type;
+    rx->stage = STAGE_TYPE;
+    rx->pos = 0;
+}
+
+// Sets up for the ciphertext once the payload length is known
+static void frame_rx_body(frame_rx *rx, uint16_t len){
+    rx->header.len = len;
+    rx->cipher_len = ((len + 15) & ~15) + FRAME_TRAILER_LEN;
+    rx->decrypted = 16;
+    rx->stage = STAGE_BODY;
+    rx->pos = 0;
+}
+
+/* ****************************************************************
+ *
+ * Decrypts the ciphertext received since the last call, except block
+ * 0, which needs the IV. bl_aes128_cbc_decrypt() leaves the last
+ * ciphertext block it read in chain, ready for the next call.
+ *
+ * \param end is the end of the received ciphertext, a multiple of 16.
+ *
+ * ****************************************************************
+ */
+static void frame_rx_decrypt(frame_rx *rx, uint32_t end){
+    if (end <= rx->decrypted){
+        return;
+    }
+    if (rx->decrypted == 16){
+        memcpy(rx->chain, rx->plain, 16);
+    }
+    bl_aes128_cbc_decrypt(rx->key, rx->chain, rx->plain + rx->decrypted, end - rx->decrypted);
+    rx->decrypted = end;
+}
+
+/* ****************************************************************
+ *
+ * Takes one byte of a frame.
+ *
+ * A wrong TYPE is rejected on its first byte and a LEN over 1024 as
+ * soon as it is complete, and the receiver starts over with the next
+ * byte.
+ *
+ * \return Returns FRAME_READY after the last byte of the IV,
+ * FRAME_BAD on a wrong type or length, FRAME_MORE otherwise
+ *
+ * ****************************************************************
+ */
+int frame_rx_byte(frame_rx *rx, uint8_t byte){
+    switch (rx->stage){
+    case STAGE_TYPE:
+        rx->header.type = byte;
+        if (byte == rx->expected_type){
+            frame_rx_body(rx, FRAME_PAYLOAD_LEN);
+        } else if (byte == (rx->expected_type | FRAME_VARIABLE)){
+            rx->stage = STAGE_LEN;
+        } else {
+            return FRAME_BAD;
+        }
+        break;
+
+    case STAGE_LEN:
+        rx->len[rx->pos++] = byte;
+        if (rx->pos == 2){
+            uint16_t len = (uint16_t)rx->len[0] | ((uint16_t)rx->len[1] << 8);
+            if (len > FRAME_PAYLOAD_LEN){
+                frame_rx_start(rx, rx->key, rx->expected_type);
+                return FRAME_BAD;
+            }
+            frame_rx_body(rx, len);
+        }
+        break;
+
+    case STAGE_BODY:
+        rx->plain[rx->pos++] = byte;
+        if (rx->pos - rx->decrypted == FRAME_DECRYPT_BATCH){
+            frame_rx_decrypt(rx, rx->pos);
+        }
+        if (rx->pos == rx->cipher_len){
+            rx->stage = STAGE_IV;
+            rx->pos = 0;
+        }
+        break;
+
+    case STAGE_IV:
+        rx->iv[rx->pos++] = byte;
+        if (rx->pos == 16){
+            return FRAME_READY;
+        }
+        break;
+    }
+    return FRAME_MORE;
+}
+
+int frame_rx_started(frame_rx *rx){
+    return rx->stage != STAGE_TYPE;
+}
+
+void frame_rx_finish(frame_rx *rx){
+    uint32_t padded = rx->cipher_len - FRAME_TRAILER_LEN;
+
+    frame_rx_decrypt(rx, rx->cipher_len);
+    bl_aes128_cbc_decrypt(rx->key, rx->iv, rx->plain, 16);
+
+    // Trailer to its fixed place, and nothing unauthenticated before it
+    memmove(rx->plain + FRAME_PAYLOAD_LEN, rx->plain + padded, FRAME_TRAILER_LEN);
+    memset(rx->plain + rx->header.len, 0, FRAME_PAYLOAD_LEN - rx->header.len);
+
+    // Ready for the next frame of the same type
+    frame_rx_start(rx, rx->key, rx->expected_type);
+}
+
+/* ****************************************************************
+ *
+ * Checks the HASH in the trailer of a finished frame.
+ *
+ * The HASH of a fixed-size frame covers its 1024 byte payload. For a
+ * length-prefixed frame it covers TYPE, LEN and the payload, so the
+ * length is authenticated too.
+ *
+ * \return Returns 0 if the hash matches, 1 if not
+ *
+ * ****************************************************************
+ */
+int frame_check_hash(frame_rx *rx){
+    frame_header *header = &rx->header;
+    uint8_t gen_hash[32];
+    int error = 0;
+
+    if (header->type & FRAME_VARIABLE){
+        bl_sha256_context ctx;
+        uint8_t prefix[3] = {header->type, header->len & 0xFF, header->len >> 8};
+
+        bl_sha256_init(&ctx);
+        bl_sha256_update(&ctx, prefix, sizeof(prefix));
+        bl_sha256_update(&ctx, rx->plain, header->len);
+        bl_sha256_out(&ctx, gen_hash);
+    } else {
+        bl_sha256(rx->plain, FRAME_PAYLOAD_LEN, gen_hash);
+    }
+
+    // Compare new HASH to old HASH
+    for (int i = 0; i < 32; i += 1) {
+        if (gen_hash[i] != rx->plain[FRAME_PAYLOAD_LEN + i]){
+            error = 1;
+        }
+    }
+    return error;
+}
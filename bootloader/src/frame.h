@@ -0,0 +1,78 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+
+/*
+ * Byte-at-a-time frame receiver.
+ *
+ * Fixed-size frames are TYPE | 1056 byte ciphertext | IV. With
+ * FRAME_VARIABLE set in TYPE the frame is TYPE | LEN | ciphertext | IV
+ * instead, where LEN (2 bytes) is the payload length and the ciphertext
+ * holds only the payload, padded to the AES block size, and the trailer.
+ *
+ * The update state machine feeds each received byte to frame_rx_byte()
+ * and never waits for a whole frame. CBC needs the previous ciphertext
+ * block, not the plaintext, so every block but the first can be
+ * decrypted before the IV arrives. The receiver decrypts each
+ * FRAME_DECRYPT_BATCH bytes as they come in while the RX interrupt
+ * keeps queueing the next ones, and frame_rx_finish() only has the
+ * rest and block 0 left once the IV is in. Batches fall at fixed
+ * offsets, so the work per frame does not depend on link timing.
+ */
+
+#define FRAME_PAYLOAD_LEN 1024 // Payload of a fixed-size frame, and the most a frame carries
+#define FRAME_TRAILER_LEN 32
+#define FRAME_PLAIN_LEN 1056   // Decrypted payload plus 32 byte trailer
+#define FRAME_VARIABLE 0x80    // Type flag: a 2 byte payload length follows the type
+
+// Ciphertext decrypted at a time while a frame comes in. Each batch
+// expands the key again, so this is kept well above one block.
+#define FRAME_DECRYPT_BATCH 512
+
+// Results of frame_rx_byte()
+#define FRAME_MORE 0  // Part of a frame
+#define FRAME_READY 1 // Last byte of a frame; call frame_rx_finish()
+#define FRAME_BAD 2   // Wrong type or length; the receiver starts over
+
+// Header of a received frame
+typedef struct {
+    uint8_t type; // As received, with FRAME_VARIABLE for length-prefixed frames
+    uint16_t len; // Payload bytes, FRAME_PAYLOAD_LEN for fixed-size frames
+} frame_header;
+
+typedef struct {
+    uint8_t key[16];
+    uint8_t expected_type;
+    uint8_t stage;        // Part of the frame the next byte belongs to
+    uint32_t pos;         // Bytes of that part received
+    uint8_t len[2];
+    uint32_t cipher_len;  // Padded payload plus trailer
+    uint32_t decrypted;   // End of the decrypted ciphertext, from block 1 on
+    uint8_t chain[16];    // Ciphertext block before plain + decrypted
+    uint8_t iv[16];
+    frame_header header;
+    uint8_t plain[FRAME_PLAIN_LEN] __attribute__((aligned(4))); // Word aligned for flash programming
+} frame_rx;
+
+// Starts receiving a frame of the given type
+void frame_rx_start(frame_rx *rx, const uint8_t *key, uint8_t expected_type);
+
+// Takes the next byte from the link. Returns one of FRAME_MORE,
+// FRAME_READY or FRAME_BAD.
+int frame_rx_byte(frame_rx *rx, uint8_t byte);
+
+// Returns 1 once the first byte of a frame is in, 0 while waiting for one
+int frame_rx_started(frame_rx *rx);
+
+// Decrypts what is left once FRAME_READY was returned. plain then holds
+// the payload, zero filled past its length to 1024 bytes, and the trailer.
+void frame_rx_finish(frame_rx *rx);
+
+// Checks the trailer hash of a finished frame. Returns 0 if it matches.
+int frame_check_hash(frame_rx *rx);
+
+#endif
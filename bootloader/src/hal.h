@@ -0,0 +1,74 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+
+/*
+ * Hardware abstraction for the update logic in bootloader.c.
+ *
+ * hal_stellaris.c implements this on the LM3S6965 with driverlib, and
+ * host/hal_host.c implements it with an in-memory flash and a scripted
+ * UART so the same bootloader.c runs natively. Output still goes through
+ * the uart_write* API, which the host build provides as well.
+ */
+
+// Flash layout
+#define FW_BASE 0x10000 // base address of firmware in Flash
+#define FLASH_PAGESIZE 1024
+#define FLASH_WRITESIZE 4
+
+// Timeout value that never expires
+#define RX_FOREVER 0xFFFFFFFF
+
+// Per-byte timeout while a frame is being received
+#define RX_FRAME_TIMEOUT_MS 2000
+
+// Main loop events
+#define HAL_EVENT_RX 1    // A byte arrived
+#define HAL_EVENT_TIMER 2 // The timeout passed without one
+
+// UARTs hal_event_wait() listens on, as a mask of 1 << UARTn
+#define HAL_INPUT(uart) (1 << (uart))
+
+typedef struct {
+    uint8_t type; // HAL_EVENT_*
+    uint8_t uart; // HAL_EVENT_RX: the UART the byte came from
+    uint8_t byte;
+} hal_event;
+
+// Brings up the UARTs, interrupts and time base
+void hal_init(void);
+
+// Sleeps until a byte arrives on one of the inputs (UART1 and UART2)
+// or timeout_ms passes. A timeout of 0 only polls. Bytes on other UARTs
+// stay queued. UART0 is not an input: its interrupt resets the device.
+void hal_event_wait(uint32_t timeout_ms, uint8_t inputs, hal_event *ev);
+
+// Milliseconds since hal_init(), for timeouts and state timing
+uint32_t hal_clock_ms(void);
+
+// Flash primitives, same contract as driverlib's FlashErase/FlashProgram
+long hal_flash_erase(uint32_t addr);
+long hal_flash_program(uint32_t *data, uint32_t addr, uint32_t len);
+
+// Pointer for reading flash at addr
+uint8_t *hal_flash_addr(uint32_t addr);
+
+// Four words of SRAM kept across a soft reset (see mailbox.h)
+volatile uint32_t *hal_mailbox(void);
+
+// Initial firmware image linked into the bootloader
+uint8_t *hal_initial_firmware(uint32_t *size);
+
+// Prints time asleep/active since the last report
+void hal_stats_report(uint8_t uart);
+
+// Neither of these return. hal_boot() stops the receive interrupts and
+// time base first, so the firmware gets the UARTs to itself.
+void hal_reset(void);
+void hal_boot(void);
+
+#endif
@@ -0,0 +1,91 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+// Hardware Imports
+#include "inc/hw_memmap.h" // Peripheral Base Addresses
+#include "inc/lm3s6965.h"  // Peripheral Bit Masks and Registers
+#include "inc/hw_types.h"  // Boolean type
+#include "inc/hw_ints.h"   // Interrupt numbers
+
+// Driver API Imports
+#include "driverlib/flash.h"     // FLASH API
+#include "driverlib/sysctl.h"    // System control API (clock/reset)
+#include "driverlib/interrupt.h" // Interrupt API
+
+// Application Imports
+#include "uart.h"
+#include "rx.h"
+#include "hal.h"
+#include "mailbox.h"
+
+// Firmware v2 is embedded in bootloader, compressed by bl_build.py (see lz.h)
+// Read up on these symbols in the objcopy man page (if you want)!
+extern int _binary_firmware_lz_start;
+extern int _binary_firmware_lz_size;
+
+void hal_init(void){
+    // Initialize UART channels
+    // 0: Reset
+    // 1: Host Connection
+    // 2: Debug
+    uart_init(UART0);
+    uart_init(UART1);
+    uart_init(UART2);
+    rx_init();
+
+    // Enable UART0 interrupt
+    IntEnable(INT_UART0);
+    IntMasterEnable();
+}
+
+void hal_event_wait(uint32_t timeout_ms, uint8_t inputs, hal_event *ev){
+    ev->type = rx_wait(timeout_ms, inputs, &ev->uart, &ev->byte) == 0 ? HAL_EVENT_RX : HAL_EVENT_TIMER;
+}
+
+uint32_t hal_clock_ms(void){
+    return clock_ms();
+}
+
+long hal_flash_erase(uint32_t addr){
+    return FlashErase(addr);
+}
+
+long hal_flash_program(uint32_t *data, uint32_t addr, uint32_t len){
+    return FlashProgram((unsigned long *)data, addr, len);
+}
+
+uint8_t *hal_flash_addr(uint32_t addr){
+    // Flash is memory mapped from address 0
+    return (uint8_t *)addr;
+}
+
+volatile uint32_t *hal_mailbox(void){
+    return (volatile uint32_t *)MAILBOX_ADDR;
+}
+
+uint8_t *hal_initial_firmware(uint32_t *size){
+    *size = (uint32_t)&_binary_firmware_lz_size;
+    return (uint8_t *)&_binary_firmware_lz_start;
+}
+
+void hal_stats_report(uint8_t uart){
+    rx_stats_report(uart);
+}
+
+void hal_reset(void){
+    SysCtlReset();
+}
+
+void hal_boot(void){
+    // The firmware owns the UARTs and RAM from here. Only the UART0 reset
+    // interrupt stays on; VTOR stays at 0 since the firmware has no vector
+    // table of its own and relies on that handler.
+    IntMasterDisable();
+    rx_shutdown();
+    IntMasterEnable();
+
+    // Jump to the firmware's reset handler (Thumb bit set)
+    __asm(
+        "LDR R0,=0x10001\n\t"
+        "BX R0\n\t");
+}
@@ -0,0 +1,222 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+// Library Imports
+#include <stddef.h>
+#include <string.h>
+
+// Application Imports
+#include "uart.h"
+#include "hal.h"
+#include "journal.h"
+
+#define JOURNAL_MAGIC 0x4C4E524A  // "JRNL"
+#define JOURNAL_COMMIT 0x54494D43 // "CMIT"
+#define JOURNAL_ERASED 0xFFFFFFFF
+
+// Fails to compile if the record no longer fills its slot exactly
+typedef char journal_record_size_check[(sizeof(journal_record) == JOURNAL_RECORD_SIZE) ? 1 : -1];
+
+// Counters carried into the next record, loaded from the latest one
+static journal_record pending;
+
+static const uint32_t journal_pages[2] = {METADATA_BASE, JOURNAL_ALT_BASE};
+
+// Slots 0 to JOURNAL_PAGE_SLOTS - 1 are in the first page, the rest in the second
+static uint32_t slot_addr(int i){
+    return journal_pages[i / JOURNAL_PAGE_SLOTS] + (i % JOURNAL_PAGE_SLOTS) * JOURNAL_RECORD_SIZE;
+}
+
+static journal_record *slot(int i){
+    return (journal_record *)hal_flash_addr(slot_addr(i));
+}
+
+// FNV-1a over the record up to the check word
+static uint32_t record_check(journal_record *r){
+    uint8_t *p = (uint8_t *)r;
+    uint32_t h = 0x811C9DC5;
+
+    for (uint32_t i = 0; i < offsetof(journal_record, check); i++){
+        h = (h ^ p[i]) * 0x01000193;
+    }
+    return h;
+}
+
+static int record_valid(journal_record *r){
+    return r->magic == JOURNAL_MAGIC && r->commit == JOURNAL_COMMIT && r->check == record_check(r);
+}
+
+// Slot of the newest committed record, or -1 if there is none
+static int latest_slot(void){
+    int latest = -1;
+
+    for (int i = 0; i < JOURNAL_SLOTS; i++){
+        journal_record *r = slot(i);
+        if (record_valid(r) && (latest < 0 || r->seq > slot(latest)->seq)){
+            latest = i;
+        }
+    }
+    return latest;
+}
+
+/* ****************************************************************
+ *
+ * Returns the newest committed record, or NULL if the journal is
+ * empty (first boot).
+ *
+ * ****************************************************************
+ */
+journal_record *journal_latest(void){
+    int latest = latest_slot();
+
+    return latest < 0 ? NULL : slot(latest);
+}
+
+/* ****************************************************************
+ *
+ * Loads the counters from the newest record. Call once at start-up,
+ * before anything is erased.
+ *
+ * ****************************************************************
+ */
+void journal_init(void){
+    journal_record *latest = journal_latest();
+
+    if (latest){
+        memcpy(&pending, latest, sizeof(pending));
+        return;
+    }
+    memset(&pending, 0, sizeof(pending));
+
+    // Carry the version and size words written before the journal over
+    // into the first record. That layout is one word in an otherwise
+    // erased page. A record torn in slot 0 (power lost before its commit
+    // word) is not it: its first word holds every bit of JOURNAL_MAGIC,
+    // and more of the page is programmed.
+    uint32_t *legacy = (uint32_t *)hal_flash_addr(METADATA_BASE);
+
+    if (legacy[0] == JOURNAL_ERASED || (legacy[0] & JOURNAL_MAGIC) == JOURNAL_MAGIC){
+        return;
+    }
+    for (int i = 1; i < JOURNAL_PAGESIZE / 4; i++){
+        if (legacy[i] != JOURNAL_ERASED){
+            return;
+        }
+    }
+    journal_commit(legacy[0] & 0xFFFF, legacy[0] >> 16, 0, NULL, NULL);
+}
+
+/* ****************************************************************
+ *
+ * Counts one erase of the page at addr for the next record.
+ *
+ * ****************************************************************
+ */
+void journal_note_erase(uint32_t addr){
+    if (addr < FW_BASE){
+        return;
+    }
+    uint32_t page = (addr - FW_BASE) / FLASH_PAGESIZE;
+    if (page < JOURNAL_TRACKED_PAGES && pending.page_erases[page] != 0xFFFF){
+        pending.page_erases[page]++;
+    }
+}
+
+/* ****************************************************************
+ *
+ * Appends a record for a completed install to the page holding the
+ * newest record (the first page if there is none). When that page is
+ * full, the other page is erased and the record goes in its first
+ * slot. The erased page never holds the newest record, so a power loss
+ * at any point leaves it, or the new record once its commit word is
+ * written, as the newest valid one.
+ *
+ * \param region_sizes is JOURNAL_REGIONS sizes of the bundle regions
+ * written with the image, or NULL if there are none.
+ * \param digest is the 32 byte image digest, or NULL if there is none.
+ *
+ * \return Returns 0 on success, or -1 if erasing or programming failed
+ *
+ * ****************************************************************
+ */
+int journal_commit(uint16_t version, uint16_t fw_size, uint16_t rm_size, uint16_t *region_sizes, uint8_t *digest){
+    int latest = latest_slot();
+    int page = latest < 0 ? 0 : latest / JOURNAL_PAGE_SLOTS;
+    int free_slot = -1;
+
+    pending.seq = latest < 0 ? 0 : slot(latest)->seq + 1;
+
+    for (int i = page * JOURNAL_PAGE_SLOTS; i < (page + 1) * JOURNAL_PAGE_SLOTS; i++){
+        if (slot(i)->magic == JOURNAL_ERASED){
+            free_slot = i;
+            break;
+        }
+    }
+
+    // Page full: switch to the other page. It holds only older records,
+    // and the new record carries everything forward.
+    if (free_slot < 0){
+        page = 1 - page;
+        if (hal_flash_erase(journal_pages[page]) != 0){
+            return -1;
+        }
+        pending.journal_erases++;
+        free_slot = page * JOURNAL_PAGE_SLOTS;
+    }
+
+    pending.magic = JOURNAL_MAGIC;
+    pending.version = version;
+    pending.fw_size = fw_size;
+    pending.rm_size = rm_size;
+    pending.update_count++;
+    if (region_sizes){
+        memcpy(pending.region_sizes, region_sizes, sizeof(pending.region_sizes));
+    } else {
+        memset(pending.region_sizes, 0, sizeof(pending.region_sizes));
+    }
+    if (digest){
+        pending.flags = JOURNAL_HAS_DIGEST;
+        memcpy(pending.digest, digest, 32);
+    } else {
+        pending.flags = 0;
+        memset(pending.digest, 0xFF, 32);
+    }
+    pending.check = record_check(&pending);
+    pending.commit = JOURNAL_COMMIT;
+
+    // Body first, commit word last, so a torn write never looks valid
+    uint32_t addr = slot_addr(free_slot);
+    if (hal_flash_program((uint32_t *)&pending, addr, offsetof(journal_record, commit)) != 0){
+        return -1;
+    }
+    return hal_flash_program(&pending.commit, addr + offsetof(journal_record, commit), 4) == 0 ? 0 : -1;
+}
+
+/* ****************************************************************
+ *
+ * Prints the wear telemetry from the newest record.
+ *
+ * ****************************************************************
+ */
+void journal_report(uint8_t uart){
+    journal_record *latest = journal_latest();
+    uint16_t max_erases = 0;
+
+    if (latest == NULL){
+        uart_write_str(uart, "Journal empty\n");
+        return;
+    }
+    for (int i = 0; i < JOURNAL_TRACKED_PAGES; i++){
+        if (latest->page_erases[i] > max_erases){
+            max_erases = latest->page_erases[i];
+        }
+    }
+
+    uart_write_str(uart, "Updates: ");
+    uart_write_hex(uart, latest->update_count);
+    uart_write_str(uart, "\nJournal erases: ");
+    uart_write_hex(uart, latest->journal_erases);
+    uart_write_str(uart, "\nMost erased page: ");
+    uart_write_hex(uart, max_erases);
+    nl(uart);
+}
@@ -0,0 +1,59 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+/*
+ * Append-only metadata journal in two alternating flash pages.
+ *
+ * Each install appends one record to the page that holds the newest
+ * record. When that page is full, the other page (which holds only
+ * older records) is erased and the record starts it, so the newest
+ * committed record is never erased before its successor is in flash.
+ * The newest valid record over both pages wins at boot. Records also
+ * carry update and erase counters so the device keeps its own wear
+ * telemetry.
+ */
+
+#define METADATA_BASE 0xFC00     // First journal page, where metadata always was
+#define JOURNAL_ALT_BASE 0x3FC00 // Second journal page: the last page of flash
+#define JOURNAL_PAGESIZE 1024
+#define JOURNAL_RECORD_SIZE 256
+#define JOURNAL_PAGE_SLOTS (JOURNAL_PAGESIZE / JOURNAL_RECORD_SIZE)
+#define JOURNAL_SLOTS (2 * JOURNAL_PAGE_SLOTS)
+
+// Firmware pages from FW_BASE with an erase counter
+#define JOURNAL_TRACKED_PAGES 94
+
+// Bundle regions after the application with a recorded size
+#define JOURNAL_REGIONS 2
+
+// Record flags
+#define JOURNAL_HAS_DIGEST 0x0001 // digest holds the manifest root
+
+typedef struct {
+    uint32_t magic;         // JOURNAL_MAGIC
+    uint32_t seq;           // Increases by one per record
+    uint16_t version;       // Installed firmware version
+    uint16_t fw_size;       // Firmware size in bytes
+    uint16_t rm_size;       // Release message size in bytes
+    uint16_t flags;         // JOURNAL_* flags
+    uint32_t update_count;  // Installs since the journal was created
+    uint32_t journal_erases; // Erases of the journal page itself
+    uint8_t digest[32];
+    uint16_t region_sizes[JOURNAL_REGIONS]; // Bytes installed per bundle region
+    uint16_t page_erases[JOURNAL_TRACKED_PAGES]; // Saturating erase counts
+    uint32_t check;         // Checksum of everything above
+    uint32_t commit;        // JOURNAL_COMMIT, programmed last
+} journal_record;
+
+void journal_init(void);
+journal_record *journal_latest(void);
+void journal_note_erase(uint32_t addr);
+int journal_commit(uint16_t version, uint16_t fw_size, uint16_t rm_size, uint16_t *region_sizes, uint8_t *digest);
+void journal_report(uint8_t uart);
+
+#endif
@@ -0,0 +1,95 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+// Application Imports
+#include "lz.h"
+
+uint32_t lz_size(const uint8_t *src, uint32_t len){
+    if (len < LZ_HEADER_LEN){
+        return 0;
+    }
+    uint32_t magic = src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+    if (magic != LZ_MAGIC){
+        return 0;
+    }
+    return src[4] | (src[5] << 8) | (src[6] << 16) | ((uint32_t)src[7] << 24);
+}
+
+void lz_put(lz_output *out, uint8_t byte){
+    uint32_t fill = out->pos % out->page_size;
+
+    out->page[fill] = byte;
+    out->pos++;
+    if (fill + 1 == out->page_size){
+        out->flush(out->pos - out->page_size, out->page, out->page_size);
+    }
+}
+
+// Byte at an earlier output position: still in the page buffer, or
+// already programmed
+static uint8_t lz_byte_at(lz_output *out, uint32_t at){
+    uint32_t page_start = out->pos - out->pos % out->page_size;
+    return at >= page_start ? out->page[at - page_start] : out->history[at];
+}
+
+/* ****************************************************************
+ *
+ * Unpacks an LZ stream into out
+ *
+ * \param src is the stream, starting with its header.
+ * \param len is the stream length in bytes.
+ *
+ * \return Returns 0 on success, or 1 if the stream is malformed
+ *
+ * ****************************************************************
+ */
+int lz_unpack(lz_output *out, const uint8_t *src, uint32_t len){
+    uint32_t end = out->pos + lz_size(src, len);
+    uint32_t i = LZ_HEADER_LEN;
+    uint8_t flags = 0;
+    int bits = 0;
+
+    while (out->pos < end){
+        if (bits == 0){
+            if (i >= len){
+                return 1;
+            }
+            flags = src[i++];
+            bits = 8;
+        }
+
+        if (flags & 1){
+            if (i >= len){
+                return 1;
+            }
+            lz_put(out, src[i++]);
+        } else {
+            if (i + 2 > len){
+                return 1;
+            }
+            uint32_t token = src[i] | (src[i + 1] << 8);
+            uint32_t distance = (token & 0x0FFF) + 1;
+            uint32_t length = (token >> 12) + LZ_MIN_MATCH;
+            i += 2;
+
+            if (distance > out->pos || length > end - out->pos){
+                return 1;
+            }
+            // Byte by byte, so a match may overlap its own output
+            for (uint32_t n = 0; n < length; n++){
+                lz_put(out, lz_byte_at(out, out->pos - distance));
+            }
+        }
+        flags >>= 1;
+        bits--;
+    }
+    return 0;
+}
+
+void lz_finish(lz_output *out){
+    uint32_t fill = out->pos % out->page_size;
+
+    if (fill != 0){
+        out->flush(out->pos - fill, out->page, fill);
+    }
+}
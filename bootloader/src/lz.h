@@ -0,0 +1,50 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+
+/*
+ * Decoder for the compressed initial firmware made by bl_build.py.
+ *
+ * Format: LZ_MAGIC, the unpacked size (4 bytes, little endian), then
+ * groups of one flag byte and eight items, flag bit 0 first. A set bit
+ * is a literal byte. A clear bit is a 2 byte match: the low 12 bits are
+ * distance - 1 (up to LZ_WINDOW back) and the high 4 bits length - 3.
+ *
+ * Output is gathered one page at a time and handed to a flush callback
+ * that programs it. Matches that reach back past the current page read
+ * the bytes from where they were already programmed, so the decoder
+ * needs no window buffer beyond the page.
+ */
+
+#define LZ_MAGIC 0x315A4C42 // "BLZ1"
+#define LZ_HEADER_LEN 8
+#define LZ_WINDOW 4096
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH 18
+
+typedef struct {
+    const uint8_t *history; // Where flushed output can be read back
+    uint8_t *page;          // Pending output, page_size bytes
+    uint32_t page_size;
+    uint32_t pos;           // Bytes output so far
+    void (*flush)(uint32_t offset, uint8_t *data, uint32_t len);
+} lz_output;
+
+// Returns the unpacked size if src starts with an LZ header, otherwise 0
+uint32_t lz_size(const uint8_t *src, uint32_t len);
+
+// Appends one byte, flushing the page when it fills
+void lz_put(lz_output *out, uint8_t byte);
+
+// Unpacks a whole stream after its header.
+// Returns 0 on success, or 1 if the stream is malformed
+int lz_unpack(lz_output *out, const uint8_t *src, uint32_t len);
+
+// Flushes a partly filled last page
+void lz_finish(lz_output *out);
+
+#endif
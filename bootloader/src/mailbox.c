@@ -0,0 +1,25 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+// Application Imports
+#include "hal.h"
+#include "mailbox.h"
+
+uint32_t mailbox_take(uint32_t *arg){
+    volatile uint32_t *box = hal_mailbox();
+    uint32_t magic = box[MAILBOX_MAGIC_WORD];
+    uint32_t command = box[MAILBOX_COMMAND_WORD];
+    uint32_t value = box[MAILBOX_ARG_WORD];
+    uint32_t check = box[MAILBOX_CHECK_WORD];
+
+    // Clear before acting, so a request that fails or resets again is not retried forever
+    for (int i = 0; i < MAILBOX_WORDS; i++){
+        box[i] = 0;
+    }
+
+    if (magic != MAILBOX_MAGIC || check != ~(magic ^ command ^ value)){
+        return MAILBOX_NONE;
+    }
+    *arg = value;
+    return command;
+}
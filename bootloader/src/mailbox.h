@@ -0,0 +1,38 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdint.h>
+
+/*
+ * Reset mailbox from the firmware to the bootloader.
+ *
+ * The last 16 bytes of SRAM are left out of both images' RAM and are not
+ * cleared by a soft reset. The firmware writes a request there and resets
+ * (firmware/lib/bl_services.h, bl_request_update()), and the bootloader
+ * takes it once at startup. Power-on garbage is rejected by the magic and
+ * check words.
+ */
+
+#define MAILBOX_ADDR 0x2000FFF0 // Top of the LM3S6965's 64 KB of SRAM
+#define MAILBOX_MAGIC 0x584F424D // "MBOX"
+
+// Word offsets
+#define MAILBOX_MAGIC_WORD 0
+#define MAILBOX_COMMAND_WORD 1
+#define MAILBOX_ARG_WORD 2 // Session tag chosen by the requester
+#define MAILBOX_CHECK_WORD 3 // ~(magic ^ command ^ arg)
+#define MAILBOX_WORDS 4
+
+// Commands
+#define MAILBOX_NONE 0
+#define MAILBOX_UPDATE 1 // Go straight to the update, skipping the banner and idle loop
+
+// Reads and clears the mailbox, so a request is acted on only once.
+// Returns the command (MAILBOX_NONE if there is no valid request) and its
+// argument through arg
+uint32_t mailbox_take(uint32_t *arg);
+
+#endif
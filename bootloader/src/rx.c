@@ -0,0 +1,218 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+// Hardware Imports
+#include "inc/hw_memmap.h" // Peripheral Base Addresses
+#include "inc/hw_types.h"  // Boolean type
+#include "inc/hw_ints.h"   // Interrupt numbers
+
+// Driver API Imports
+#include "driverlib/interrupt.h" // Interrupt API
+#include "driverlib/sysctl.h"    // System control API (clock)
+#include "driverlib/systick.h"   // SysTick API (time base)
+#include "driverlib/uart.h"      // UART register access for the RX interrupt
+
+// Application Imports
+#include "uart.h"
+#include "rx.h"
+
+/*
+ * Interrupt driven receive for the host and debug UARTs.
+ *
+ * The UART1 and UART2 RX/RX-timeout interrupts drain the hardware FIFOs
+ * into ring buffers, and the main loop sleeps in WFI until a ring it
+ * listens to has data or its timeout passes. SysTick runs at 1 ms and
+ * doubles as the cycle counter for the stats and the crypto benchmark.
+ */
+
+// Must be a power of two
+#define RX_RING_SIZE 256
+
+typedef struct {
+    volatile uint8_t data[RX_RING_SIZE];
+    volatile uint32_t head; // Written by the ISR
+    volatile uint32_t tail; // Written by the main loop
+} rx_ring;
+
+// UART1 and UART2, by UART number
+#define RX_FIRST UART1
+#define RX_COUNT 2
+
+static rx_ring rings[RX_COUNT];
+static uint8_t rx_next = 0;         // Ring checked first, for fairness
+
+static volatile uint32_t ticks = 0; // Milliseconds since rx_init()
+static uint32_t tick_period = 0;    // Cycles per millisecond
+static uint32_t stats_start = 0;    // ticks at the last stats reset
+static uint64_t sleep_cycles = 0;   // Cycles spent in WFI since then
+
+static void rx_drain(uint32_t base, rx_ring *ring){
+    uint32_t status = UARTIntStatus(base, true);
+    UARTIntClear(base, status);
+
+    while (UARTCharsAvail(base)){
+        uint8_t c = UARTCharGetNonBlocking(base);
+        // Drop the byte if the ring is full; the frame hash will catch it
+        if (ring->head - ring->tail < RX_RING_SIZE){
+            ring->data[ring->head & (RX_RING_SIZE - 1)] = c;
+            ring->head++;
+        }
+    }
+}
+
+void UART1_IRQHandler(void){
+    rx_drain(UART1_BASE, &rings[UART1 - RX_FIRST]);
+}
+
+void UART2_IRQHandler(void){
+    rx_drain(UART2_BASE, &rings[UART2 - RX_FIRST]);
+}
+
+void SysTick_Handler(void){
+    ticks++;
+}
+
+/* ****************************************************************
+ *
+ * Starts the 1 ms time base and the UART1 and UART2 receive
+ * interrupts. Must be called after uart_init() of both.
+ *
+ * ****************************************************************
+ */
+void rx_init(void){
+    tick_period = SysCtlClockGet() / 1000;
+    SysTickPeriodSet(tick_period);
+    SysTickIntEnable();
+    SysTickEnable();
+
+    UARTIntEnable(UART1_BASE, UART_INT_RX | UART_INT_RT);
+    IntEnable(INT_UART1);
+    UARTIntEnable(UART2_BASE, UART_INT_RX | UART_INT_RT);
+    IntEnable(INT_UART2);
+
+    stats_start = ticks;
+    sleep_cycles = 0;
+}
+
+/* ****************************************************************
+ *
+ * Undoes rx_init(): stops SysTick and the UART1 and UART2 receive
+ * interrupts and clears any that are pending, so nothing writes into
+ * the bootloader's RAM once the firmware owns it. Interrupts must be
+ * masked.
+ *
+ * ****************************************************************
+ */
+void rx_shutdown(void){
+    SysTickIntDisable();
+    SysTickDisable();
+    IntPendClear(FAULT_SYSTICK);
+
+    UARTIntDisable(UART1_BASE, UART_INT_RX | UART_INT_RT);
+    UARTIntClear(UART1_BASE, UART_INT_RX | UART_INT_RT);
+    IntDisable(INT_UART1);
+    IntPendClear(INT_UART1);
+    UARTIntDisable(UART2_BASE, UART_INT_RX | UART_INT_RT);
+    UARTIntClear(UART2_BASE, UART_INT_RX | UART_INT_RT);
+    IntDisable(INT_UART2);
+    IntPendClear(INT_UART2);
+}
+
+uint32_t clock_ms(void){
+    return ticks;
+}
+
+/* ****************************************************************
+ *
+ * Returns a free running cycle count built from the millisecond tick
+ * and the current SysTick value. Wraps every 2^32 cycles.
+ *
+ * ****************************************************************
+ */
+uint32_t clock_cycles(void){
+    uint32_t ms, val;
+
+    // Re-read if the tick interrupt fired in between
+    do {
+        ms = ticks;
+        val = SysTickValueGet();
+    } while (ms != ticks);
+
+    return ms * tick_period + (tick_period - 1 - val);
+}
+
+// Takes a byte from the first ring in inputs that has one, starting
+// after the ring served last. Interrupts must be masked.
+static int rx_take(uint8_t inputs, uint8_t *uart, uint8_t *dest){
+    for (int i = 0; i < RX_COUNT; i++){
+        int r = (rx_next + i) % RX_COUNT;
+        rx_ring *ring = &rings[r];
+        if ((inputs & (1 << (RX_FIRST + r))) && ring->head != ring->tail){
+            *uart = RX_FIRST + r;
+            *dest = ring->data[ring->tail & (RX_RING_SIZE - 1)];
+            ring->tail++;
+            rx_next = (r + 1) % RX_COUNT;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* ****************************************************************
+ *
+ * Reads one byte from UART1 or UART2, sleeping until it arrives.
+ *
+ * \param timeout_ms is how long to wait, 0 to only poll, or
+ * RX_FOREVER.
+ * \param inputs is the mask of UARTs to read, 1 << UARTn each.
+ * \param uart receives the UART the byte came from.
+ * \param dest is where to write the byte.
+ *
+ * \return Returns 0 if a byte was read, 1 on timeout
+ *
+ * ****************************************************************
+ */
+int rx_wait(uint32_t timeout_ms, uint8_t inputs, uint8_t *uart, uint8_t *dest){
+    uint32_t start = ticks;
+
+    while (1){
+        // Interrupts stay masked between the check and WFI so a byte that
+        // lands in between still wakes us; it is serviced once unmasked.
+        IntMasterDisable();
+        if (rx_take(inputs, uart, dest) == 0){
+            IntMasterEnable();
+            return 0;
+        }
+        if (timeout_ms != RX_FOREVER && ticks - start >= timeout_ms){
+            IntMasterEnable();
+            return 1;
+        }
+        uint32_t before = clock_cycles();
+        __asm("wfi");
+        IntMasterEnable();
+        sleep_cycles += clock_cycles() - before;
+    }
+}
+
+/* ****************************************************************
+ *
+ * Prints time asleep and active since the last report, then resets
+ * the counters.
+ *
+ * \param uart is the UART the report is written to.
+ *
+ * ****************************************************************
+ */
+void rx_stats_report(uint8_t uart){
+    uint32_t now = ticks;
+    uint32_t asleep = (uint32_t)(sleep_cycles / tick_period);
+
+    uart_write_str(uart, "Asleep (ms): ");
+    uart_write_hex(uart, asleep);
+    uart_write_str(uart, "\nActive (ms): ");
+    uart_write_hex(uart, (now - stats_start) - asleep);
+    nl(uart);
+
+    stats_start = now;
+    sleep_cycles = 0;
+}
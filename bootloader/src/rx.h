@@ -0,0 +1,17 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#ifndef RX_H
+#define RX_H
+
+#include <stdint.h>
+#include "hal.h" // RX_FOREVER
+
+void rx_init(void);
+void rx_shutdown(void);
+int rx_wait(uint32_t timeout_ms, uint8_t inputs, uint8_t *uart, uint8_t *dest);
+uint32_t clock_ms(void);
+uint32_t clock_cycles(void);
+void rx_stats_report(uint8_t uart);
+
+#endif
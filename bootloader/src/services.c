@@ -0,0 +1,113 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+// Hardware Imports
+#include "inc/hw_memmap.h" // Peripheral Base Addresses
+#include "inc/hw_types.h"  // Boolean type
+
+// Driver API Imports
+#include "driverlib/uart.h" // UART register access
+
+// Application Imports
+#include "uart.h"
+#include "crypto.h"
+#include "hal.h"
+#include "journal.h"
+#include "services.h"
+
+/*
+ * Entries of the bootloader service table (see services.h).
+ *
+ * These wrap the routines the update path uses, minus anything that
+ * keeps state in bootloader RAM: the M3 AES kernel builds its tables in
+ * RAM, so AES always goes to BearSSL here, and UART reads poll the
+ * hardware FIFO instead of the interrupt driven ring in rx.c.
+ */
+
+#define FLASH_END JOURNAL_ALT_BASE // Flash the firmware may use ends at the second journal page
+
+typedef char sha256_context_size_check[(sizeof(bl_sha256_context) <= sizeof(bl_svc_sha256_context)) ? 1 : -1];
+
+static const uint32_t uart_base[] = { UART0_BASE, UART1_BASE, UART2_BASE };
+
+static void svc_sha256_init(bl_svc_sha256_context *ctx){
+    bl_sha256_init((bl_sha256_context *)ctx);
+}
+
+static void svc_sha256_update(bl_svc_sha256_context *ctx, const uint8_t *data, uint32_t len){
+    bl_sha256_update((bl_sha256_context *)ctx, data, len);
+}
+
+static void svc_sha256_out(bl_svc_sha256_context *ctx, uint8_t *out){
+    bl_sha256_out((bl_sha256_context *)ctx, out);
+}
+
+/* ****************************************************************
+ *
+ * Erases one flash page for the firmware.
+ *
+ * \param addr is the page address. Pages below FW_BASE hold the
+ * bootloader and the first journal page, and the last page holds the
+ * second; both are refused.
+ *
+ * \return Returns 0 on success, -1 on failure or a refused address
+ *
+ * ****************************************************************
+ */
+static long svc_flash_erase(uint32_t addr){
+    if (addr < FW_BASE || addr >= FLASH_END || (addr % FLASH_PAGESIZE) != 0){
+        return -1;
+    }
+    return hal_flash_erase(addr);
+}
+
+/* ****************************************************************
+ *
+ * Programs flash for the firmware.
+ *
+ * \param data is the words to write.
+ * \param addr is where to write them, at or above FW_BASE and below
+ * the second journal page.
+ * \param len is the number of bytes, a multiple of FLASH_WRITESIZE.
+ *
+ * \return Returns 0 on success, -1 on failure or a refused range
+ *
+ * ****************************************************************
+ */
+static long svc_flash_program(uint32_t *data, uint32_t addr, uint32_t len){
+    if (addr < FW_BASE || addr >= FLASH_END || len > FLASH_END - addr ||
+        (addr % FLASH_WRITESIZE) != 0 || (len % FLASH_WRITESIZE) != 0){
+        return -1;
+    }
+    return hal_flash_program(data, addr, len);
+}
+
+static void svc_uart_write(uint8_t uart, uint32_t data){
+    if (uart <= UART2){
+        UARTCharPut(uart_base[uart], (unsigned char)data);
+    }
+}
+
+static int svc_uart_read(uint8_t uart, uint8_t *dest){
+    if (uart > UART2 || !UARTCharsAvail(uart_base[uart])){
+        return 1;
+    }
+    *dest = (uint8_t)UARTCharGetNonBlocking(uart_base[uart]);
+    return 0;
+}
+
+const bl_services bl_service_table = {
+    .magic = BL_SERVICES_MAGIC,
+    .version = BL_SERVICES_VERSION,
+    .size = sizeof(bl_services),
+
+    .sha256 = bl_sha256,
+    .sha256_init = svc_sha256_init,
+    .sha256_update = svc_sha256_update,
+    .sha256_out = svc_sha256_out,
+    .aes128_cbc_decrypt = aes128_br_cbc_decrypt,
+    .flash_erase = svc_flash_erase,
+    .flash_program = svc_flash_program,
+    .uart_write = svc_uart_write,
+    .uart_read = svc_uart_read,
+};
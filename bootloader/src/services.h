@@ -0,0 +1,60 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#ifndef SERVICES_H
+#define SERVICES_H
+
+#include <stdint.h>
+
+/*
+ * Bootloader service table.
+ *
+ * Lets the firmware call the bootloader's SHA-256, AES, flash and UART
+ * routines instead of linking its own copies. The table's address is
+ * stored in reserved vector table slot BL_SERVICES_VECTOR (0x1C), so the
+ * firmware finds it without knowing the bootloader's link map. The
+ * firmware side is firmware/lib/bl_services.h, which must match this
+ * layout.
+ *
+ * Services run on the firmware's stack and must not touch bootloader RAM,
+ * which the firmware owns once booted. Everything behind the table is
+ * therefore stateless, and callers hold any state.
+ *
+ * The layout only ever grows: new entries go at the end together with a
+ * BL_SERVICES_VERSION bump, and existing entries never move or change.
+ */
+
+#define BL_SERVICES_MAGIC 0x43565342 // "BSVC" little endian
+#define BL_SERVICES_VERSION 1
+#define BL_SERVICES_VECTOR 7         // Vector table slot holding &bl_service_table
+
+// Room for either backend's SHA-256 state
+#define BL_SHA256_CONTEXT_SIZE 128
+
+typedef struct {
+    uint32_t opaque[BL_SHA256_CONTEXT_SIZE / 4];
+} bl_svc_sha256_context;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version; // Entries up to this version are present
+    uint16_t size;    // sizeof(bl_services) in the bootloader
+
+    // Version 1
+    void (*sha256)(const uint8_t *data, uint32_t len, uint8_t *out);
+    void (*sha256_init)(bl_svc_sha256_context *ctx);
+    void (*sha256_update)(bl_svc_sha256_context *ctx, const uint8_t *data, uint32_t len);
+    void (*sha256_out)(bl_svc_sha256_context *ctx, uint8_t *out);
+    // len is a multiple of 16; iv is updated for chaining
+    void (*aes128_cbc_decrypt)(const uint8_t *key, uint8_t *iv, uint8_t *data, uint32_t len);
+    // Only pages at or above FW_BASE; return -1 outside that range
+    long (*flash_erase)(uint32_t addr);
+    long (*flash_program)(uint32_t *data, uint32_t addr, uint32_t len);
+    void (*uart_write)(uint8_t uart, uint32_t data);
+    // Returns 0 if a byte was read, 1 if none was waiting
+    int (*uart_read)(uint8_t uart, uint8_t *dest);
+} bl_services;
+
+extern const bl_services bl_service_table;
+
+#endif
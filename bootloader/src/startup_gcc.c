@@ -58,6 +58,17 @@ static void IntDefaultHandler(void);
 //
 //******************************************************************************
 extern void UART0_IRQHandler(void);
+extern void UART1_IRQHandler(void);
+extern void UART2_IRQHandler(void);
+extern void SysTick_Handler(void);
+
+//*****************************************************************************
+//
+// Bootloader service table, published in the first reserved vector slot
+// (BL_SERVICES_VECTOR) so the firmware can find it. See services.h.
+//
+//*****************************************************************************
+#include "services.h"
 
 
 
@@ -73,16 +84,21 @@ extern int main(void);
 //
 // Reserve space for the system stack.
 //
+// The initial firmware install keeps a page buffer on the stack, so this
+// has to hold a few KB. 64 words was overrun by frame decryption alone.
+//
 //*****************************************************************************
-static unsigned long pulStack[64];
+static unsigned long pulStack[2048];
 
 //*****************************************************************************
 //
 // The vector table.  Note that the proper constructs must be placed on this to
-// ensure that it ends up at physical address 0x0000.0000.
+// ensure that it ends up at physical address 0x0000.0000.  Nothing refers to
+// it by name, so it is marked used to survive LTO; bootloader.ld keeps its
+// section through --gc-sections.
 //
 //*****************************************************************************
-__attribute__ ((section(".isr_vector")))
+__attribute__ ((section(".isr_vector"), used))
 void (* const g_pfnVectors[])(void) =
 {
     (void (*)(void))((unsigned long)pulStack + sizeof(pulStack)),
@@ -93,7 +109,8 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // The MPU fault handler
     IntDefaultHandler,                      // The bus fault handler
     IntDefaultHandler,                      // The usage fault handler
-    0,                                      // Reserved
+    (void (*)(void))((unsigned long)&bl_service_table),
+                                            // Reserved: bootloader service table
     0,                                      // Reserved
     0,                                      // Reserved
     0,                                      // Reserved
@@ -101,14 +118,14 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // Debug monitor handler
     0,                                      // Reserved
     IntDefaultHandler,                      // The PendSV handler
-    IntDefaultHandler,                      // The SysTick handler
+    SysTick_Handler,                        // The SysTick handler
     IntDefaultHandler,                      // GPIO Port A
     IntDefaultHandler,                      // GPIO Port B
     IntDefaultHandler,                      // GPIO Port C
     IntDefaultHandler,                      // GPIO Port D
     IntDefaultHandler,                      // GPIO Port E
     UART0_IRQHandler,                      // UART0 Rx and Tx
-    IntDefaultHandler,                      // UART1 Rx and Tx
+    UART1_IRQHandler,                       // UART1 Rx and Tx
     IntDefaultHandler,                      // SSI0 Rx and Tx
     IntDefaultHandler,                      // I2C0 Master and Slave
     IntDefaultHandler,                      // PWM Fault
@@ -135,7 +152,7 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // GPIO Port F
     IntDefaultHandler,                      // GPIO Port G
     IntDefaultHandler,                      // GPIO Port H
-    IntDefaultHandler,                      // UART2 Rx and Tx
+    UART2_IRQHandler,                       // UART2 Rx and Tx
     IntDefaultHandler,                      // SSI1 Rx and Tx
     IntDefaultHandler,                      // Timer 3 subtimer A
     IntDefaultHandler,                      // Timer 3 subtimer B
@@ -0,0 +1,104 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#include "bl_services.h"
+
+#include <stddef.h>
+
+#define FW_BASE 0x10000 // The table lives in bootloader flash, below the firmware
+
+#define NVIC_APINT 0xE000ED0C
+#define NVIC_APINT_SYSRESETREQ 0x05FA0004 // Key and system reset request
+
+void bl_request_update(uint32_t session)
+{
+    volatile uint32_t *box = (volatile uint32_t *)BL_MAILBOX_ADDR;
+    box[0] = BL_MAILBOX_MAGIC;
+    box[1] = BL_MAILBOX_UPDATE;
+    box[2] = session;
+    box[3] = ~(BL_MAILBOX_MAGIC ^ BL_MAILBOX_UPDATE ^ session);
+
+    *(volatile uint32_t *)NVIC_APINT = NVIC_APINT_SYSRESETREQ;
+    while(1);
+}
+
+const bl_services *bl_services_get(uint16_t version)
+{
+    // The bootloader's vector table is at address 0. Older bootloaders
+    // leave the slot 0
+    uint32_t addr = *(volatile const uint32_t *)(BL_SERVICES_VECTOR * 4);
+    if(addr == 0 || addr >= FW_BASE || (addr & 3) != 0) return NULL;
+
+    const bl_services *table = (const bl_services *)addr;
+    if(table->magic != BL_SERVICES_MAGIC || table->version < version) return NULL;
+    return table;
+}
+
+int bl_sha256(const uint8_t *data, uint32_t len, uint8_t *out)
+{
+    const bl_services *s = bl_services_get(1);
+    if(s == NULL) return -1;
+    s->sha256(data, len, out);
+    return 0;
+}
+
+int bl_sha256_init(bl_svc_sha256_context *ctx)
+{
+    const bl_services *s = bl_services_get(1);
+    if(s == NULL) return -1;
+    s->sha256_init(ctx);
+    return 0;
+}
+
+int bl_sha256_update(bl_svc_sha256_context *ctx, const uint8_t *data, uint32_t len)
+{
+    const bl_services *s = bl_services_get(1);
+    if(s == NULL) return -1;
+    s->sha256_update(ctx, data, len);
+    return 0;
+}
+
+int bl_sha256_out(bl_svc_sha256_context *ctx, uint8_t *out)
+{
+    const bl_services *s = bl_services_get(1);
+    if(s == NULL) return -1;
+    s->sha256_out(ctx, out);
+    return 0;
+}
+
+int bl_aes128_cbc_decrypt(const uint8_t *key, uint8_t *iv, uint8_t *data, uint32_t len)
+{
+    const bl_services *s = bl_services_get(1);
+    if(s == NULL || (len % 16) != 0) return -1;
+    s->aes128_cbc_decrypt(key, iv, data, len);
+    return 0;
+}
+
+long bl_flash_erase(uint32_t addr)
+{
+    const bl_services *s = bl_services_get(1);
+    if(s == NULL) return -1;
+    return s->flash_erase(addr);
+}
+
+long bl_flash_program(uint32_t *data, uint32_t addr, uint32_t len)
+{
+    const bl_services *s = bl_services_get(1);
+    if(s == NULL) return -1;
+    return s->flash_program(data, addr, len);
+}
+
+int bl_uart_write(uint8_t uart, uint32_t data)
+{
+    const bl_services *s = bl_services_get(1);
+    if(s == NULL) return -1;
+    s->uart_write(uart, data);
+    return 0;
+}
+
+int bl_uart_read(uint8_t uart, uint8_t *dest)
+{
+    const bl_services *s = bl_services_get(1);
+    if(s == NULL) return -1;
+    return s->uart_read(uart, dest);
+}
@@ -0,0 +1,64 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+#ifndef BL_SERVICES_H
+#define BL_SERVICES_H
+
+#include <stdint.h>
+
+// Calls into the bootloader's SHA-256, AES, flash and UART routines so the
+// firmware does not have to link its own. The table layout must match
+// bootloader/src/services.h.
+
+#define BL_SERVICES_MAGIC 0x43565342 // "BSVC"
+#define BL_SERVICES_VECTOR 7         // Vector table slot holding the table address
+#define BL_SHA256_CONTEXT_SIZE 128
+
+typedef struct
+{
+    uint32_t opaque[BL_SHA256_CONTEXT_SIZE / 4];
+} bl_svc_sha256_context;
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+
+    // Version 1
+    void (*sha256)(const uint8_t *data, uint32_t len, uint8_t *out);
+    void (*sha256_init)(bl_svc_sha256_context *ctx);
+    void (*sha256_update)(bl_svc_sha256_context *ctx, const uint8_t *data, uint32_t len);
+    void (*sha256_out)(bl_svc_sha256_context *ctx, uint8_t *out);
+    void (*aes128_cbc_decrypt)(const uint8_t *key, uint8_t *iv, uint8_t *data, uint32_t len);
+    long (*flash_erase)(uint32_t addr);
+    long (*flash_program)(uint32_t *data, uint32_t addr, uint32_t len);
+    void (*uart_write)(uint8_t uart, uint32_t data);
+    int (*uart_read)(uint8_t uart, uint8_t *dest);
+} bl_services;
+
+// Reset mailbox at the top of SRAM, see bootloader/src/mailbox.h
+#define BL_MAILBOX_ADDR 0x2000FFF0
+#define BL_MAILBOX_MAGIC 0x584F424D // "MBOX"
+#define BL_MAILBOX_UPDATE 1
+
+// Asks the bootloader to go straight into update mode and resets. The
+// session tag is printed by the bootloader. Does not return.
+void bl_request_update(uint32_t session);
+
+// Returns the table if the bootloader provides at least the given version, else NULL
+const bl_services *bl_services_get(uint16_t version);
+
+// Stubs: return -1 if the bootloader has no service table
+int bl_sha256(const uint8_t *data, uint32_t len, uint8_t *out);
+int bl_sha256_init(bl_svc_sha256_context *ctx);
+int bl_sha256_update(bl_svc_sha256_context *ctx, const uint8_t *data, uint32_t len);
+int bl_sha256_out(bl_svc_sha256_context *ctx, uint8_t *out);
+int bl_aes128_cbc_decrypt(const uint8_t *key, uint8_t *iv, uint8_t *data, uint32_t len);
+// Flash and UART stubs pass the service's result through (see services.h)
+long bl_flash_erase(uint32_t addr);
+long bl_flash_program(uint32_t *data, uint32_t addr, uint32_t len);
+int bl_uart_write(uint8_t uart, uint32_t data);
+int bl_uart_read(uint8_t uart, uint8_t *dest);
+
+#endif
@@ -4,6 +4,7 @@
 #include "mitre_car.h"
 #include "uart.h"
 #include "usart.h"
+#include "bl_services.h"
 
 #include <string.h>
 
@@ -35,6 +36,7 @@ static const char *HELP_TEXT =
     " * SAFETY - Query safety system status\n"
     " * INFOTAINMENT - Query information/entertainment system status\n"
     " * SECURITY - Query cybersecurity system status\n"
+    " * UPDATE - Reset into the bootloader's update mode\n"
     " * FLAG - ???\n"
     "\n";
 
@@ -76,6 +78,11 @@ void parseCommand(char* buffer, int len)
                   "Firewall disabled because it stops the airbags from "
                   "deploying.");
     }
+    else if(strncmp(buffer, "UPDATE", len) == 0)
+    {
+        writeLine("Resetting into update mode.");
+        bl_request_update(0);
+    }
     else if(strncmp(buffer, "FLAG", len) == 0);
     else
     {
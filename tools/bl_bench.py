@@ -0,0 +1,279 @@
+#!/usr/bin/env python
+
+# Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+# Approved for public release. Distribution unlimited 23-02181-13.
+
+"""
+Bootloader Instruction Count Benchmark
+
+Runs one update and boot under QEMU with the bl_insn TCG plugin
+(tools/plugin) and reports how many guest instructions each stage of the
+bootloader executed. QEMU is not cycle accurate, so wall clock time is
+noise; instruction counts should repeat run to run, so two reports can
+be diffed between commits. --baseline does that diff and fails on
+regressions, for CI. Stages may grow by --tolerance percent (0.5 by
+default) before that counts as a regression, to absorb any variation
+between runs or between QEMU versions.
+
+Symbols come from bootloader/gcc/main.axf and are grouped into stages by
+name below. A symbol is counted without its callees, so AES and SHA-256
+work done inside frame_check_hash shows up under aes and sha256.
+
+The update uses a synthetic image: a stub that writes "!" to UART1 and
+spins, padded with seeded random bytes. It boots to a known point and
+does not change between commits, so only the bootloader moves the counts.
+"""
+import argparse
+import contextlib
+import fnmatch
+import os
+import pathlib
+import random
+import subprocess
+import sys
+import tempfile
+from bl_emulate import qemu_command
+from fw_protect import protect_frames
+from fw_update import frame_type, read_exact, update
+from util import *
+
+REPO_ROOT = pathlib.Path(__file__).parent.parent.absolute()
+PLUGIN_DIR = os.path.join(REPO_ROOT, "tools", "plugin")
+DATA_FRAME = 2
+TOLERANCE = 0.5 # Default allowed growth per stage, in percent
+
+# Thumb code at FW_BASE: ldr r0, =UART1_DR; movs r1, #'!'; str r1, [r0]; b .
+FIRMWARE_STUB = bytes.fromhex("01482121 0160fee7 00d00040")
+BOOTED = b"!"
+
+# Stage name, whether its count depends on host timing, symbol patterns.
+# The first matching stage wins. Anything unmatched is "other".
+STAGES = [
+    # Sleeping for bytes and the interrupts that wake the core scale with
+    # how fast the host sends, not with the work done
+    ("wait", True, ["rx_wait", "rx_take", "rx_drain", "hal_event_wait", "clock_*", "SysTick_Handler",
+                    "UART1_IRQHandler", "UART2_IRQHandler", "UARTChars*", "UARTCharGetNonBlocking",
+                    "UARTInt*", "IntMaster*", "CPUcpsi*", "CPUwfi"]),
+    ("receive", False, ["frame_rx_byte", "frame_rx_start", "frame_rx_body", "frame_rx_started", "update_event", "update_rx",
+                        "update_timer", "update_wait_ms", "update_inputs", "update_enter", "update_expect",
+                        "update_ack", "update_frame", "update_held", "update_timed", "frame_error*", "start_frame",
+                        "data_frame", "data_ack", "end_frame", "manifest_*", "link_*", "stripe_*"]),
+    ("aes", False, ["*aes*", "*cbcdec*"]),
+    ("sha256", False, ["*sha2*", "br_range_*32be"]),
+    ("frame_decrypt", False, ["frame_rx_decrypt", "frame_rx_finish", "frame_check_hash"]),
+    ("program_flash", False, ["program_flash", "flash_start", "flash_step", "page_programmed", "update_commit",
+                              "hal_flash_*", "Flash*", "journal_*"]),
+    ("boot_firmware", False, ["boot_firmware", "verify_image", "hal_boot"]),
+    ("startup", False, ["ResetISR", "hal_init", "rx_init", "load_initial_firmware", "initial_flush", "lz_*"]),
+]
+UNMAPPED = "(unmapped)" # Written by the plugin for code outside main.axf
+FIXED_STAGES = ["startup", "boot_firmware"] # Once per run, not per frame
+
+# Reads the function symbols of the bootloader
+# Takes the ELF file and the nm to use
+# Returns a list of (start, end, name)
+def read_symbols(elf_path, nm):
+    out = subprocess.run([nm, "-S", "--defined-only", str(elf_path)], check=True,
+                         capture_output=True, text=True).stdout
+    symbols = []
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) != 4 or fields[2] not in "TtWw":
+            continue
+        # Thumb symbols have bit 0 set
+        start = int(fields[0], 16) & ~1
+        symbols.append((start, start + int(fields[1], 16), fields[3]))
+    return symbols
+
+# Returns the stage a symbol belongs to
+def stage_of(name):
+    if name == UNMAPPED:
+        return UNMAPPED
+    for stage, _, patterns in STAGES:
+        if any(fnmatch.fnmatchcase(name, p) for p in patterns):
+            return stage
+    return "other"
+
+# Builds the plugin with make
+# Returns the path of the shared object
+def make_plugin(qemu_inc=None):
+    cmd = ["make", "-C", PLUGIN_DIR]
+    if qemu_inc:
+        cmd.append(f"QEMU_INC={qemu_inc}")
+    subprocess.run(cmd, check=True, stdout=sys.stderr)
+    return os.path.join(PLUGIN_DIR, "build", "libbl_insn.so")
+
+# Makes the synthetic firmware image
+# Takes the size in bytes and the seed for the padding
+def synthetic_image(size, seed):
+    if size < len(FIRMWARE_STUB) or size > 0xFFFF:
+        raise ValueError(f"image size must be {len(FIRMWARE_STUB)} to 65535 bytes")
+    return FIRMWARE_STUB + random.Random(seed).randbytes(size - len(FIRMWARE_STUB))
+
+# Runs one update and boot with the plugin loaded
+# Takes the bootloader ELF, plugin, symbols, frames and timeout in seconds
+# Returns {symbol: (instructions, entries)} and the number of DATA frames
+def run_benchmark(binary_path, plugin, symbols, frames, timeout):
+    with tempfile.TemporaryDirectory(prefix="bl_bench_") as tmp:
+        syms_path = os.path.join(tmp, "syms.txt")
+        counts_path = os.path.join(tmp, "counts.txt")
+        with open(syms_path, "w") as fp:
+            for start, end, name in symbols:
+                fp.write(f"{start:x} {end:x} {name}\n")
+
+        cmd = qemu_command(binary_path, uart_dir=tmp, extra=["-plugin", f"{plugin},syms={syms_path},out={counts_path}"])
+        log = open(os.path.join(tmp, "qemu.log"), "wb")
+        process = subprocess.Popen(cmd, cwd=tmp, stdin=subprocess.DEVNULL, stdout=log, stderr=subprocess.STDOUT)
+        log.close()
+
+        data_frames = 0
+        def counted(frames):
+            nonlocal data_frames
+            for frame in frames:
+                data_frames += frame_type(frame) == DATA_FRAME
+                yield frame
+
+        try:
+            uart0_path, uart1_path, uart2_path = uart_paths(tmp)
+            uart0_sock = connect_uart(uart0_path, timeout)
+            uart1_sock = connect_uart(uart1_path, timeout)
+            uart2_sock = connect_uart(uart2_path, timeout)
+            uart0_sock.close()
+            uart2_sock.close()
+            uart1_sock.settimeout(timeout)
+            uart1 = DomainSocketSerial(uart1_sock)
+
+            # Keep fw_update's progress off stdout, where the report goes
+            with contextlib.redirect_stdout(sys.stderr):
+                update(ser=uart1, frames=counted(frames), debug=False)
+
+            # Boot, and wait for the stub so boot_firmware has finished
+            uart1.write(b"B")
+            if read_exact(uart1, 1) != b"B" or read_exact(uart1, 1) != BOOTED:
+                raise RuntimeError("firmware did not boot")
+            uart1.close()
+        finally:
+            # QEMU runs the plugin's exit callback on SIGTERM
+            process.terminate()
+            process.wait()
+
+        counts = {}
+        with open(counts_path) as fp:
+            for line in fp:
+                name, insns, entries = line.split()
+                counts[name] = (int(insns), int(entries))
+        return counts, data_frames
+
+# Measures the bootloader's cost per DATA frame: the compared stages
+# over a hashed update, less startup and boot. LTO may inline across
+# stages, so between build profiles compare this total, not the stages.
+# Takes the bootloader ELF, the nm to use, where to find qemu-plugin.h,
+# the image size and seed and the timeout in seconds
+# Returns the instructions per DATA frame
+def frame_cost(binary_path, nm="arm-none-eabi-nm", qemu_inc=None, size=16384, seed=0, timeout=60.0):
+    plugin = make_plugin(qemu_inc)
+    symbols = read_symbols(binary_path, nm)
+    with tempfile.NamedTemporaryFile(suffix=".bin") as image:
+        image.write(synthetic_image(size, seed))
+        image.flush()
+        frames = protect_frames(image.name, 0, "bl_bench")
+        counts, data_frames = run_benchmark(binary_path, plugin, symbols, frames, timeout)
+
+    per_frame = [s for s, variable, _ in STAGES if not variable and s not in FIXED_STAGES] + ["other"]
+    insns = sum(insns for name, (insns, _) in counts.items() if stage_of(name) in per_frame)
+    return insns // max(data_frames, 1)
+
+# Formats the report. Only counts and fixed settings go in, so the same
+# bootloader always produces the same text
+# Takes the plugin counts, the number of DATA frames and a settings line
+# Returns the report as a string
+def format_report(counts, data_frames, settings):
+    totals = {}
+    for name, (insns, _) in counts.items():
+        stage = stage_of(name)
+        totals[stage] = totals.get(stage, 0) + insns
+
+    stable = [s for s, variable, _ in STAGES if not variable] + ["other"]
+    lines = ["# bl_bench: guest instructions per stage", f"# {settings}, {data_frames} DATA frames", "#",
+             f"# {'stage':<16} {'instructions':>14} {'per frame':>12}"]
+    for stage in stable:
+        insns = totals.get(stage, 0)
+        lines.append(f"{stage:<18} {insns:>14} {insns // max(data_frames, 1):>12}")
+    lines.append(f"{'total':<18} {sum(totals.get(s, 0) for s in stable):>14}")
+
+    lines += ["#", "# timing dependent, not compared"]
+    for stage in [s for s, variable, _ in STAGES if variable] + [UNMAPPED]:
+        lines.append(f"{stage:<18} {totals.get(stage, 0):>14}")
+
+    lines += ["#", f"# {'symbol':<32} {'stage':<14} {'instructions':>14} {'entries':>10}"]
+    for name in sorted((n for n in counts if stage_of(n) in stable), key=lambda n: (stage_of(n), n)):
+        insns, entries = counts[name]
+        lines.append(f"{name:<34} {stage_of(name):<14} {insns:>14} {entries:>10}")
+    return "\n".join(lines) + "\n"
+
+# Reads the compared stage totals back out of a report
+# Returns {stage: instructions}
+def parse_report(text):
+    totals = {}
+    for line in text.splitlines():
+        if line.startswith("# timing dependent"):
+            break
+        fields = line.split()
+        if fields and not line.startswith("#"):
+            totals[fields[0]] = int(fields[1])
+    return totals
+
+# Prints the change of every stage against a baseline report
+# Takes both reports and the allowed growth in percent
+# Returns True if no stage grew by more than that
+def compare_reports(baseline, current, tolerance):
+    old, new = parse_report(baseline), parse_report(current)
+    ok = True
+    for stage in new:
+        before, after = old.get(stage, 0), new[stage]
+        change = 100.0 * (after - before) / before if before else 0.0
+        regressed = after > before and (before == 0 or change > tolerance)
+        ok = ok and not regressed
+        flag = "  REGRESSION" if regressed else ""
+        print(f"{stage:<18} {before:>14} -> {after:>14} {change:>+8.2f}%{flag}", file=sys.stderr)
+    return ok
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Bootloader Instruction Count Benchmark")
+    parser.add_argument("--boot-path", help="Path to the bootloader ELF.", default=os.path.join(REPO_ROOT, "bootloader/gcc/main.axf"))
+    parser.add_argument("--size", help="Size of the synthetic firmware image in bytes.", type=int, default=16384)
+    parser.add_argument("--seed", help="Seed for the image padding.", type=int, default=0)
+    parser.add_argument("--manifest", help="Benchmark a manifest update instead of a hashed one.", action="store_true")
+    parser.add_argument("--nm", help="nm for the ARM toolchain.", default="arm-none-eabi-nm")
+    parser.add_argument("--qemu-inc", help="Directory holding qemu-plugin.h, if not on the default path.", default=None)
+    parser.add_argument("--timeout", help="Seconds to wait on the emulator.", type=float, default=60.0)
+    parser.add_argument("--outfile", help="Where to write the report (default stdout).", default=None)
+    parser.add_argument("--baseline", help="Earlier report to compare against; exits 1 on a regression.", default=None)
+    parser.add_argument("--tolerance", help=f"Allowed growth per stage in percent (default: {TOLERANCE}).", type=float, default=TOLERANCE)
+    args = parser.parse_args()
+
+    binary_path = pathlib.Path(args.boot_path).resolve()
+    plugin = make_plugin(args.qemu_inc)
+    symbols = read_symbols(binary_path, args.nm)
+
+    message = "bl_bench"
+    mode = "manifest" if args.manifest else "hashed"
+    with tempfile.NamedTemporaryFile(suffix=".bin") as image:
+        image.write(synthetic_image(args.size, args.seed))
+        image.flush()
+        frames = protect_frames(image.name, 0, message, manifest=args.manifest)
+        counts, data_frames = run_benchmark(binary_path, plugin, symbols, frames, args.timeout)
+
+    settings = f"{mode} update, image {args.size} bytes (seed {args.seed}), message {len(message)} bytes"
+    report = format_report(counts, data_frames, settings)
+    if args.outfile:
+        with open(args.outfile, "w") as fp:
+            fp.write(report)
+    else:
+        sys.stdout.write(report)
+
+    if args.baseline:
+        with open(args.baseline) as fp:
+            baseline = fp.read()
+        sys.exit(0 if compare_reports(baseline, report, args.tolerance) else 1)
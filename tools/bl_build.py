@@ -24,6 +24,13 @@ from pwn import *
 REPO_ROOT = pathlib.Path(__file__).parent.parent.absolute()
 BOOTLOADER_DIR = os.path.join(REPO_ROOT, "bootloader")
 
+# Must match bootloader/src/lz.h
+LZ_MAGIC = b"BLZ1"
+LZ_WINDOW = 4096
+LZ_MIN_MATCH = 3
+LZ_MAX_MATCH = 18
+LZ_CHAIN_DEPTH = 64 # Candidates kept per prefix; more is slower but smaller
+
 # Generates random byte strings
 # Takes number of bytes to be generated
 # Returns generated bytes
@@ -38,17 +45,98 @@ def generate(num):
 def arrayize(binary_string):
     return '{' + ', '.join([hex(char) for char in binary_string]) + '}'
 
-# Copies initial firmware binary to the bootloader
+# Compresses data in the format lz.c unpacks: "BLZ1", the size, then
+# groups of a flag byte and 8 items (bit set: literal byte, clear:
+# 12 bit distance - 1 and 4 bit length - 3)
+# Takes the data to compress
+# Returns the compressed bytes
+def lz_compress(data):
+    out = bytearray(LZ_MAGIC + len(data).to_bytes(4, "little"))
+    chains = {}  # 3 byte prefix -> recent positions, newest last
+    items = []
+    pos = 0
+
+    while pos < len(data):
+        best_len, best_dist = 0, 0
+        key = data[pos : pos + LZ_MIN_MATCH]
+        if len(key) == LZ_MIN_MATCH:
+            for cand in reversed(chains.get(key, [])):
+                if pos - cand > LZ_WINDOW:
+                    break
+                length = LZ_MIN_MATCH
+                while length < LZ_MAX_MATCH and pos + length < len(data) and data[cand + length] == data[pos + length]:
+                    length += 1
+                if length > best_len:
+                    best_len, best_dist = length, pos - cand
+                    if length == LZ_MAX_MATCH:
+                        break
+
+        step = best_len if best_len >= LZ_MIN_MATCH else 1
+        if step == 1:
+            items.append(bytes([data[pos]]))
+        else:
+            token = (best_dist - 1) | ((best_len - LZ_MIN_MATCH) << 12)
+            items.append(token.to_bytes(2, "little"))
+
+        # Index every position covered, keeping the chains short
+        for p in range(pos, pos + step):
+            chain = chains.setdefault(data[p : p + LZ_MIN_MATCH], [])
+            chain.append(p)
+            if len(chain) > LZ_CHAIN_DEPTH:
+                del chain[0]
+        pos += step
+
+    for i in range(0, len(items), 8):
+        group = items[i : i + 8]
+        out.append(sum(1 << n for n, item in enumerate(group) if len(item) == 1))
+        for item in group:
+            out += item
+    return bytes(out)
+
+# Compresses the initial firmware binary into the bootloader
+# Takes the firmware path
+# Returns the raw and compressed sizes
 def copy_initial_firmware(binary_path: str):
     os.chdir(os.path.join(REPO_ROOT, "tools"))
-    shutil.copy(binary_path, os.path.join(BOOTLOADER_DIR, "src/firmware.bin"))
-
-# Builds the bootloader from source
-def make_bootloader() -> bool:
+    with open(binary_path, "rb") as fp:
+        raw = fp.read()
+    packed = lz_compress(raw)
+    # Without the LZ header the bootloader copies the image as is
+    if len(packed) >= len(raw):
+        packed = raw
+    with open(os.path.join(BOOTLOADER_DIR, "src/firmware.lz"), "wb") as fp:
+        fp.write(packed)
+
+    # A stale uncompressed copy would also match the firmware.o rule
+    stale = os.path.join(BOOTLOADER_DIR, "src/firmware.bin")
+    if os.path.exists(stale):
+        os.remove(stale)
+    return len(raw), len(packed)
+
+# Prints the size of the embedded firmware and the bootloader image,
+# with and without compression
+# Takes the raw and compressed firmware sizes
+def report_sizes(raw, packed):
+    print(f"Initial firmware: {raw} bytes, {packed} compressed ({100 * packed / max(raw, 1):.1f}%)")
+    image = os.path.join(BOOTLOADER_DIR, "gcc/main.bin")
+    if os.path.isfile(image):
+        size = os.path.getsize(image)
+        print(f"Bootloader image: {size} bytes ({size - packed + raw} with the firmware uncompressed)")
+
+# Builds the bootloader from source. make prints its flash and SRAM
+# footprint.
+# Takes the crypto backend, whether to include the benchmark command and
+# the build profile ("default", "size" or "speed")
+def make_bootloader(crypto="bearssl", bench=False, profile="default") -> bool:
     os.chdir(BOOTLOADER_DIR)
 
     subprocess.call("make clean", shell=True)
-    status = subprocess.call("make")
+    cmd = ["make", f"CRYPTO={crypto}"]
+    if bench:
+        cmd.append("BENCH=1")
+    if profile != "default":
+        cmd.append(f"PROFILE={profile}")
+    status = subprocess.call(cmd)
 
     # Return True if make returned 0, otherwise return False.
     return status == 0
@@ -62,6 +150,20 @@ if __name__ == "__main__":
         help="Path to the the firmware binary.",
         default=os.path.join(REPO_ROOT, "firmware/gcc/main.bin"),
     )
+    parser.add_argument(
+        "--crypto",
+        help="Crypto backend for the update path.",
+        choices=["bearssl", "fast"],
+        default="bearssl",
+    )
+    parser.add_argument("--bench", help="Include the 'T' crypto benchmark command.", action="store_true")
+    parser.add_argument(
+        "--profile",
+        help="Build profile: size (-Os, LTO, section GC) or speed (section GC, crypto at -O2).",
+        choices=["default", "size", "speed"],
+        default="default",
+    )
+    parser.add_argument("--measure", help="Measure the update cost per frame under QEMU (see bl_bench.py).", action="store_true")
     args = parser.parse_args()
     firmware_path = os.path.abspath(pathlib.Path(args.initial_firmware))
 
@@ -87,7 +189,13 @@ if __name__ == "__main__":
         file.write('#endif')
     
     # Copies firmware and builds bootloader
-    copy_initial_firmware(firmware_path)
-    make_bootloader()
+    raw, packed = copy_initial_firmware(firmware_path)
+    built = make_bootloader(crypto=args.crypto, bench=args.bench, profile=args.profile)
+    report_sizes(raw, packed)
+
+    if built and args.measure:
+        from bl_bench import frame_cost
+        cost = frame_cost(os.path.join(BOOTLOADER_DIR, "gcc/main.axf"))
+        print(f"Update cost: {cost} instructions per DATA frame ({args.profile} profile)")
 
 
@@ -10,15 +10,24 @@ import os
 from util import *
 
 
-def emulate(binary_path, debug=False):
-    cmd = ["qemu-system-arm", "-M", "lm3s6965evb", "-nographic", "-kernel", binary_path]
+# Builds the QEMU command line for one emulated device
+# Takes the bootloader binary, whether to wait for GDB, the socket
+# directory, the GDB port and any extra QEMU arguments
+# Returns the command as a list
+def qemu_command(binary_path, debug=False, uart_dir=UART_DIR, gdb_port=1234, extra=()):
+    cmd = ["qemu-system-arm", "-M", "lm3s6965evb", "-nographic", "-kernel", str(binary_path)]
+    cmd.extend(extra)
 
     if debug:
-        cmd.extend(["-s", "-S"])
+        cmd.extend(["-gdb", f"tcp::{gdb_port}", "-S"])
+
+    for path in uart_paths(uart_dir):
+        cmd.extend(["-serial", f"unix:{path},server"])
+    return cmd
 
-    uart_paths = ["/embsec/UART0", "/embsec/UART1", "/embsec/UART2"]
-    for i in range(3):
-        cmd.extend(["-serial", f"unix:{uart_paths[i]},server"])
+
+def emulate(binary_path, debug=False):
+    cmd = qemu_command(binary_path, debug=debug)
     
     # Try to kill and delete leftover stuff before starting qemu
     os.system("pkill qemu")
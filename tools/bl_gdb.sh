@@ -3,9 +3,13 @@
 # Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
 # Approved for public release. Distribution unlimited 23-02181-13.
 
-if printf -v regex ':%04X .* 0A ' 1234;grep -q "$regex" /proc/net/tcp*;
+# Usage: ./bl_gdb.sh [port]
+# The port defaults to 1234 (bl_emulate.py). Pool instances print theirs.
+PORT=${1:-1234}
+
+if printf -v regex ':%04X .* 0A ' "$PORT";grep -q "$regex" /proc/net/tcp*;
 then
-    gdb-multiarch -ex 'target remote :1234' -ex 'layout split' -ex 'file ../bootloader/gcc/main.axf'
+    gdb-multiarch -ex "target remote :$PORT" -ex 'layout split' -ex 'file ../bootloader/gcc/main.axf'
 else
-    echo "Didn't detect GDB port listening. Did you remember to run python ./bl_emulate --debug ?"
-fi
\ No newline at end of file
+    echo "Didn't detect GDB port $PORT listening. Did you remember to run python ./bl_emulate --debug (or bl_pool.py --debug)?"
+fi
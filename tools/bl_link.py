@@ -0,0 +1,267 @@
+#!/usr/bin/env python
+
+# Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+# Approved for public release. Distribution unlimited 23-02181-13.
+
+"""
+Serial Link Emulator
+
+Sits between fw_update.py and an emulator's UART sockets, so a run in
+QEMU (or bl_host -u) sees a link like the harness's 115200 baud lines
+instead of a Unix socket with no bandwidth limit and no latency.
+
+The tool listens on UART0-2 in its own directory and forwards each one
+to the emulator's socket of the same name. UART1 (and any other UART
+given with --uarts) is shaped in both directions:
+
+- Each byte takes 10 bit times on the wire (8N1), so throughput is
+  capped at the baud rate.
+- Bytes arrive after a fixed latency plus seeded random jitter, never
+  out of order.
+- Bits are flipped, bytes dropped and bytes duplicated at the given
+  rates from a seeded RNG, so a failing run can be repeated exactly
+  (as long as the host sends the same bytes).
+
+Every write to either side, and every impairment, goes to the timing log
+with the time, UART and direction. A summary per direction is printed
+when the session ends.
+
+    python bl_link.py --listen-dir /tmp/link --baud 115200 --latency 5 --jitter 2 \\
+        --bit-error 1e-5 --seed 3 --log link.log &
+    python fw_update.py --uart-dir /tmp/link --firmware protected.bin
+"""
+import argparse
+import os
+import queue
+import random
+import socket
+import sys
+import threading
+import time
+from util import *
+
+BITS_PER_BYTE = 10 # 8N1: start bit, 8 data bits, stop bit
+TO_DEVICE = "to-device"
+TO_HOST = "to-host"
+CLOSED = object() # Queued after the last byte of a direction
+
+# How one direction of a shaped UART behaves
+class LinkModel:
+    def __init__(self, baud, latency, jitter, bit_error, drop, duplicate):
+        self.byte_time = BITS_PER_BYTE / baud if baud else 0.0
+        self.latency = latency / 1000
+        self.jitter = jitter / 1000
+        self.bit_error = bit_error
+        self.drop = drop
+        self.duplicate = duplicate
+
+# The timing log, shared by every direction
+class TimingLog:
+    def __init__(self, path):
+        self.fp = open(path, "w") if path else None
+        self.start = time.monotonic()
+        self.lock = threading.Lock()
+        if self.fp:
+            self.fp.write("# seconds uart direction event bytes delay_ms\n")
+
+    # Writes one event: "send" for bytes written out, or an impairment
+    def write(self, uart, direction, event, count, delay=0.0):
+        if not self.fp:
+            return
+        with self.lock:
+            self.fp.write(f"{time.monotonic() - self.start:.6f} UART{uart} {direction} {event} {count} {delay * 1000:.3f}\n")
+
+    def close(self):
+        if self.fp:
+            self.fp.close()
+
+# One direction of one UART: bytes read from src are shaped by the model
+# (or passed through if there is none) and written to dst.
+# A reader thread schedules every byte and a writer thread sends them when
+# they are due, so the reader never falls behind the line.
+class Direction:
+    def __init__(self, uart, name, src, dst, model, rng, log):
+        self.uart = uart
+        self.name = name
+        self.src = src
+        self.dst = dst
+        self.model = model
+        self.rng = rng
+        self.log = log
+        self.queue = queue.Queue()
+        self.wire_free = 0.0 # When the bytes already on the wire have been sent
+        self.last_due = 0.0  # Due time of the last byte; bytes never overtake
+        self.stats = {"in": 0, "out": 0, "sends": 0, "dropped": 0, "duplicated": 0, "flipped": 0,
+                      "delay": 0.0, "max_delay": 0.0}
+        self.threads = [threading.Thread(target=self.read_loop, daemon=True),
+                        threading.Thread(target=self.write_loop, daemon=True)]
+
+    def start(self):
+        for thread in self.threads:
+            thread.start()
+
+    def join(self):
+        for thread in self.threads:
+            thread.join()
+
+    # Applies the error model to one byte
+    # Returns the bytes that go on the wire: none, one or two copies
+    def impair(self, byte):
+        model = self.model
+        if self.rng.random() < model.drop:
+            self.stats["dropped"] += 1
+            self.log.write(self.uart, self.name, "drop", 1)
+            return b""
+        flips = 0
+        for bit in range(8):
+            if self.rng.random() < model.bit_error:
+                byte ^= 1 << bit
+                flips += 1
+        if flips:
+            self.stats["flipped"] += flips
+            self.log.write(self.uart, self.name, "flip", flips)
+        if self.rng.random() < model.duplicate:
+            self.stats["duplicated"] += 1
+            self.log.write(self.uart, self.name, "duplicate", 1)
+            return bytes([byte, byte])
+        return bytes([byte])
+
+    # Reads from src until it closes and schedules each byte
+    def read_loop(self):
+        while True:
+            try:
+                data = self.src.recv(4096)
+            except OSError:
+                data = b""
+            if not data:
+                break
+            now = time.monotonic()
+            self.stats["in"] += len(data)
+            if not self.model:
+                self.queue.put((now, now, data))
+                continue
+
+            model = self.model
+            for byte in data:
+                for out in self.impair(byte):
+                    self.wire_free = max(self.wire_free, now) + model.byte_time
+                    due = self.wire_free + max(model.latency + self.rng.uniform(-model.jitter, model.jitter), 0)
+                    self.last_due = max(due, self.last_due)
+                    self.queue.put((self.last_due, now, bytes([out])))
+        self.queue.put(CLOSED)
+
+    # Writes each byte when it is due, batching bytes that are due together,
+    # and half-closes dst once src has closed
+    def write_loop(self):
+        item = self.queue.get()
+        while item is not CLOSED:
+            due, arrived, data = item
+            wait = due - time.monotonic()
+            if wait > 0:
+                time.sleep(wait)
+
+            # Everything else that is already due goes in the same write
+            batch = bytearray(data)
+            delay = due - arrived
+            item = None
+            while item is None and not self.queue.empty():
+                item = self.queue.get_nowait()
+                if item is not CLOSED and item[0] <= time.monotonic():
+                    batch += item[2]
+                    item = None
+
+            try:
+                self.dst.sendall(batch)
+            except OSError:
+                break
+            self.stats["out"] += len(batch)
+            self.stats["sends"] += 1
+            self.stats["delay"] += delay
+            self.stats["max_delay"] = max(self.stats["max_delay"], delay)
+            self.log.write(self.uart, self.name, "send", len(batch), delay)
+            if item is None:
+                item = self.queue.get()
+        try:
+            self.dst.shutdown(socket.SHUT_WR)
+        except OSError:
+            pass
+
+    # Prints the totals for this direction. The delay is that of the first
+    # byte of each write, from arrival to delivery.
+    def summary(self):
+        s = self.stats
+        print(f"UART{self.uart} {self.name:<9} in {s['in']:>8} out {s['out']:>8} dropped {s['dropped']:>5} "
+              f"duplicated {s['duplicated']:>5} bits flipped {s['flipped']:>5} "
+              f"delay mean {1000 * s['delay'] / max(s['sends'], 1):.2f} ms max {1000 * s['max_delay']:.2f} ms",
+              file=sys.stderr)
+
+# Listens on listen_dir/UART0-2 and, as each client connects, connects the
+# emulator's UART of the same name. Clients have to come in order, the way
+# fw_update.py does, because QEMU only listens on one socket at a time.
+# Takes the parsed arguments
+def serve(args):
+    os.makedirs(args.listen_dir, exist_ok=True)
+    listeners = []
+    for path in uart_paths(args.listen_dir):
+        if os.path.exists(path):
+            os.remove(path)
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.bind(path)
+        sock.listen(1)
+        listeners.append((path, sock))
+    print(f"Listening on {args.listen_dir}/UART0-2, forwarding to {args.uart_dir}", file=sys.stderr)
+
+    model = LinkModel(args.baud, args.latency, args.jitter, args.bit_error, args.drop, args.duplicate)
+    log = TimingLog(args.log)
+    directions = []
+    for uart, ((path, listener), device_path) in enumerate(zip(listeners, uart_paths(args.uart_dir))):
+        client, _ = listener.accept()
+        listener.close()
+        os.remove(path)
+        device = connect_uart(device_path, args.timeout)
+
+        # Each direction has its own RNG, so the bytes sent one way don't
+        # change the errors injected the other way
+        shaped = uart in args.uarts
+        for name, src, dst in [(TO_DEVICE, client, device), (TO_HOST, device, client)]:
+            impaired = shaped and args.impair in (name, "both")
+            link = model if impaired else (LinkModel(args.baud, args.latency, args.jitter, 0, 0, 0) if shaped else None)
+            rng = random.Random(f"{args.seed}:{uart}:{name}")
+            directions.append(Direction(uart, name, src, dst, link, rng, log))
+            directions[-1].start()
+
+    # The session ends when the host is done with UART1 and the device
+    # has seen it go
+    for direction in directions:
+        if direction.uart == 1:
+            direction.join()
+    for direction in directions:
+        if direction.uart in args.uarts:
+            direction.summary()
+    log.close()
+
+# Parses a comma separated list of UART numbers
+def uart_list(text):
+    uarts = [int(u) for u in text.split(",")]
+    if any(u not in (0, 1, 2) for u in uarts):
+        raise argparse.ArgumentTypeError("UARTs are 0, 1 and 2")
+    return uarts
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Serial Link Emulator")
+    parser.add_argument("--listen-dir", help="Directory for the sockets the host connects to.", required=True)
+    parser.add_argument("--uart-dir", help="Socket directory of the emulator instance.", default=UART_DIR)
+    parser.add_argument("--uarts", help="UARTs to shape, comma separated; the rest pass through.", type=uart_list, default=[1])
+    parser.add_argument("--baud", help="Line rate in bits per second, 0 for unlimited.", type=int, default=115200)
+    parser.add_argument("--latency", help="Fixed delay per byte in ms.", type=float, default=0.0)
+    parser.add_argument("--jitter", help="Random delay added to or taken from the latency, up to this many ms.", type=float, default=0.0)
+    parser.add_argument("--bit-error", help="Probability of each bit being flipped.", type=float, default=0.0)
+    parser.add_argument("--drop", help="Probability of each byte being dropped.", type=float, default=0.0)
+    parser.add_argument("--duplicate", help="Probability of each byte being sent twice.", type=float, default=0.0)
+    parser.add_argument("--impair", help="Directions that get errors, drops and duplicates.",
+                        choices=[TO_DEVICE, TO_HOST, "both"], default="both")
+    parser.add_argument("--seed", help="Seed for the jitter and errors.", type=int, default=0)
+    parser.add_argument("--log", help="File for the per-direction timing log.", default=None)
+    parser.add_argument("--timeout", help="Seconds to wait for the emulator's sockets.", type=float, default=10.0)
+    serve(parser.parse_args())
@@ -0,0 +1,173 @@
+#!/usr/bin/env python
+
+# Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+# Approved for public release. Distribution unlimited 23-02181-13.
+
+"""
+Emulator Pool Manager
+
+Runs several emulated devices side by side. Unlike bl_emulate.py, which
+owns the fixed /embsec sockets and kills every QEMU on the machine, each
+pool instance gets its own socket directory and GDB port, and only the
+pool's own processes are ever stopped.
+
+Each instance also gets its own flash directory. The rig's QEMU keeps
+flash state under /flash, which bl_emulate.py clears on every start, so
+when /flash exists each QEMU runs in a private mount namespace with its
+instance's flash directory bound over /flash. Instances never see each
+other's flash, and the host's /flash is left alone. A QEMU without
+/flash keeps flash in its own process memory and runs unwrapped.
+"""
+import argparse
+import os
+import pathlib
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+from concurrent.futures import ThreadPoolExecutor
+from bl_emulate import qemu_command
+from util import *
+
+FLASH_DIR = "/flash" # Where the rig's QEMU keeps flash state
+
+
+# One emulated device: its QEMU process, socket directory, flash
+# directory and GDB port
+class Instance:
+    def __init__(self, index, uart_dir, flash_dir, gdb_port, process):
+        self.index = index
+        self.uart_dir = uart_dir
+        self.flash_dir = flash_dir
+        self.gdb_port = gdb_port
+        self.process = process
+
+    # Fills {index}, {uart_dir}, {flash_dir} and {gdb_port} in a command template
+    def format(self, template):
+        return template.format(index=self.index, uart_dir=self.uart_dir, flash_dir=self.flash_dir, gdb_port=self.gdb_port)
+
+
+# Wraps a QEMU command so it sees flash_dir as FLASH_DIR, in a mount
+# namespace of its own (and a user namespace when not run as root)
+# Returns the wrapped command as a list
+def private_flash(cmd, flash_dir):
+    unshare = ["unshare", "--mount"]
+    if os.geteuid() != 0:
+        unshare[1:1] = ["--user", "--map-root-user"]
+    return unshare + ["sh", "-c", f'mount --bind "$0" {FLASH_DIR} && exec "$@"', flash_dir] + list(cmd)
+
+
+# Starts and stops a set of emulator instances
+# Use as a context manager so instances are torn down on any exit
+class EmulatorPool:
+    def __init__(self, binary_path, count, base_dir=None, gdb_base_port=1234, debug=False):
+        self.binary_path = binary_path
+        self.count = count
+        self.base_dir = base_dir
+        self.gdb_base_port = gdb_base_port
+        self.debug = debug
+        self.root = None
+        self.instances = []
+
+    def __enter__(self):
+        self.start()
+        return self
+
+    def __exit__(self, *exc):
+        self.stop()
+
+    # Launches every instance, then waits until each one is listening
+    # Takes how long to wait for readiness in seconds
+    def start(self, timeout=10.0):
+        self.root = tempfile.mkdtemp(prefix="bl_pool_", dir=self.base_dir)
+        for i in range(self.count):
+            uart_dir = os.path.join(self.root, str(i))
+            flash_dir = os.path.join(uart_dir, "flash")
+            os.mkdir(uart_dir)
+            os.mkdir(flash_dir)
+            cmd = qemu_command(self.binary_path, self.debug, uart_dir, self.gdb_base_port + i)
+            if os.path.isdir(FLASH_DIR):
+                cmd = private_flash(cmd, flash_dir)
+            log = open(os.path.join(uart_dir, "qemu.log"), "wb")
+            process = subprocess.Popen(cmd, cwd=uart_dir, stdin=subprocess.DEVNULL, stdout=log, stderr=subprocess.STDOUT)
+            log.close()
+            self.instances.append(Instance(i, uart_dir, flash_dir, self.gdb_base_port + i, process))
+
+        # QEMU creates UART0 first and waits there for a client
+        deadline = time.monotonic() + timeout
+        for inst in self.instances:
+            uart0 = uart_paths(inst.uart_dir)[0]
+            while not os.path.exists(uart0):
+                if inst.process.poll() is not None:
+                    raise RuntimeError(f"instance {inst.index} exited, see {inst.uart_dir}/qemu.log")
+                if time.monotonic() > deadline:
+                    raise TimeoutError(f"instance {inst.index} not ready after {timeout}s")
+                time.sleep(0.01)
+
+    # Stops every instance and removes the socket and flash directories
+    def stop(self):
+        for inst in self.instances:
+            if inst.process.poll() is None:
+                inst.process.terminate()
+        for inst in self.instances:
+            try:
+                inst.process.wait(timeout=5)
+            except subprocess.TimeoutExpired:
+                inst.process.kill()
+                inst.process.wait()
+        self.instances = []
+        if self.root:
+            shutil.rmtree(self.root, ignore_errors=True)
+            self.root = None
+
+    # Runs a shell command against every instance at once
+    # Takes a template with {index}, {uart_dir}, {flash_dir} and {gdb_port}
+    # Returns a list of (instance, return code, seconds)
+    def run(self, template):
+        def one(inst):
+            t = time.monotonic()
+            code = subprocess.call(inst.format(template), shell=True)
+            return inst, code, time.monotonic() - t
+
+        with ThreadPoolExecutor(len(self.instances)) as executor:
+            return list(executor.map(one, self.instances))
+
+
+# Turns SIGTERM into a normal exit so the pool is torn down
+def handle_sigterm(signum, frame):
+    sys.exit(128 + signum)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Emulator Pool Manager")
+    parser.add_argument("-n", "--instances", help="Number of emulated devices.", type=int, default=os.cpu_count())
+    parser.add_argument("--boot-path", help="Path to the the bootloader binary.", default=None)
+    parser.add_argument("--base-dir", help="Where to create the per-instance socket directories.", default=None)
+    parser.add_argument("--gdb-base-port", help="GDB port of instance 0; instance i uses this plus i.", type=int, default=1234)
+    parser.add_argument("--debug", help="Start each GDB server and break on first instruction.", action="store_true")
+    parser.add_argument("--run", help="Shell command to run once per instance, in parallel. {index}, {uart_dir}, {flash_dir} and {gdb_port} are filled in; the pool exits when all are done.")
+    args = parser.parse_args()
+
+    if args.boot_path is None:
+        binary_path = (pathlib.Path(__file__).parent / ".." / "bootloader" / "gcc" / "main.axf")
+    else:
+        binary_path = pathlib.Path(args.boot_path)
+
+    signal.signal(signal.SIGTERM, handle_sigterm)
+    with EmulatorPool(binary_path.resolve(), args.instances, args.base_dir, args.gdb_base_port, args.debug) as pool:
+        if args.run:
+            results = pool.run(args.run)
+            for inst, code, seconds in results:
+                print(f"instance {inst.index}: exit {code} in {seconds:.2f}s")
+            sys.exit(max(code != 0 for _, code, _ in results))
+
+        # Interactive: list the endpoints and hold the pool until Ctrl-C
+        for inst in pool.instances:
+            print(f"instance {inst.index}: --uart-dir {inst.uart_dir} flash {inst.flash_dir} gdb port {inst.gdb_port}")
+        try:
+            while all(inst.process.poll() is None for inst in pool.instances):
+                time.sleep(0.5)
+        except KeyboardInterrupt:
+            pass
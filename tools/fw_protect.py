@@ -6,12 +6,50 @@
 """
 Firmware Bundle-and-Protect Tool
 
+With --cache DIR, DATA frames are kept in DIR and reused when the same
+chunk is packaged again for the same key, version and page. Cached
+frames get their IV and padding from an HMAC of the chunk, keyed with a
+nonce made once per cache, instead of from os.urandom. The same chunk
+therefore always encrypts to the same frame, and two different chunks
+never share an IV. START, MANIFEST and END frames are made fresh every
+time. Each key has its own directory under DIR. After a complete run,
+the least recently used entries of that directory are evicted until it
+fits in --cache-size MB; entries the run used are kept, and nothing
+outside the key's directory is touched. --cache-clear empties the key's
+directory before packaging.
 """
 import argparse
-import random
+import itertools
+import mmap
+import multiprocessing
+import os
+import shutil
+import sys
+import tempfile
 from Crypto.Cipher import AES
 from pwn import *
-from Crypto.Hash import SHA256
+from Crypto.Hash import HMAC, SHA256
+
+MANIFEST_MAGIC = b"MFNT" # Marks a START frame that carries a manifest
+MANIFEST_FRAME = 4       # Frame type carrying page hashes
+BUNDLE_MAGIC = b"BNDL"   # Marks a manifest START frame with a component table
+CHUNK_SIZE = 1024        # Most payload bytes per frame
+FRAME_VARIABLE = 0x80    # Type flag: a 2 byte payload length follows the type
+POOL_CHUNKSIZE = 32      # Frames handed to a worker at a time
+CACHE_NONCE_LEN = 16     # Bytes of the per-cache nonce the IVs are derived from
+CACHE_SIZE = 64          # Default cache size per key, in MB
+
+# Fixed flash regions a bundle component can target: name -> (id, max size)
+# Must match region_base/region_limit in bootloader.c
+REGIONS = {
+    "calibration": (1, 0x2000),
+    "data": (2, 0x4000),
+}
+
+# Key, header and frame cache of a pool worker, set once by init_worker
+worker_key = None
+worker_header = None
+worker_cache = None
 
 # Pads the input data using random characters
 # Takes the data to be padded, and the completed size
@@ -20,94 +58,349 @@ def randPad(data, size):
     # Calculates the number of bytes of padding
     toPad = size - len(data) % size
 
-    randData = b""
-    # Generates padding
-    for i in range(toPad):
-        randData += p8(random.randint(0, 255), endian = "little")
-
-    return data + randData
+    # Generates padding in one call to the OS CSPRNG
+    return data + os.urandom(toPad)
 
 # Encrypts the input data using CBC
 # Takes the data to be encrypted, the key,
-# and additional authenticated data
+# additional authenticated data, optionally the 32 byte trailer
+# (defaults to the SHA256 of the data) and optionally the IV (defaults
+# to a random one)
 # Returns the encypted data
-def encrypt(data, key, header):
+def encrypt(data, key, header, trailer=None, iv=None):
     #create hash, but don't send it over yet
-    
-    h = SHA256.new()
-    h.update(data)
+    if trailer is None:
+        h = SHA256.new()
+        h.update(data)
+        trailer = h.digest()
 
     # Returns encrypted data, tag and IV
-    plaintext = data + h.digest()
-    cipher = AES.new(key, AES.MODE_CBC)
+    plaintext = data + trailer
+    cipher = AES.new(key, AES.MODE_CBC, iv=iv)
     
     iv = cipher.iv
     ct_bytes = cipher.encrypt(plaintext)
     
     return(ct_bytes + iv)
 
-# Packages the firmware
-# Takes firmware location, output location,
-# version, release message, and keys location
-def protect_firmware(infile, outfile, version, message):
-    # Load firmware binary from infile
-    with open(infile, 'rb') as fp:
-        firmware = fp.read()
+# Builds a frame that carries only its real payload:
+# type | length | AES-CBC(payload, padded to 16 bytes, + trailer) | IV
+# Takes the frame type, payload (at most 1 KB), key, header and optionally
+# the trailer (defaults to the SHA256 of type, length and payload, so the
+# length is authenticated too) and a 32 byte seed for the IV and padding
+# (defaults to random ones)
+# Returns the frame
+def make_frame(type, payload, key, header, trailer=None, seed=None):
+    prefix = p8(type | FRAME_VARIABLE, endian = "little") + p16(len(payload), endian = "little")
+    if trailer is None:
+        trailer = SHA256.new(prefix + payload).digest()
+    if len(payload) % 16:
+        payload = randPad(payload, 16) if seed is None else payload + seed[16 : 32 - len(payload) % 16]
+    return prefix + encrypt(payload, key, header, trailer, None if seed is None else seed[:16])
+
+# Size of a frame with the given payload length
+def frame_size(length):
+    return 3 + (length + 15) // 16 * 16 + 32 + 16
+
+# Cache of DATA frames for one key, in a directory of its own under the
+# cache root (named by a key id, so the key itself is never stored)
+class FrameCache:
+    def __init__(self, root, key, header, size=CACHE_SIZE, clear=False):
+        key_id = SHA256.new(b"fw_protect key id" + key + header).hexdigest()[:16]
+        self.dir = os.path.join(root, key_id)
+        if clear:
+            shutil.rmtree(self.dir, ignore_errors=True)
+        os.makedirs(self.dir, exist_ok=True)
+        self.max_bytes = size * 1024 * 1024
+        self.iv_key = HMAC.new(key, b"fw_protect iv" + self.nonce(), SHA256).digest()
+        self.hits = 0
+        self.misses = 0
+        self.used = set() # Entry file names of this run
+
+    # Reads the cache's nonce, making it on first use
+    # Returns the nonce
+    def nonce(self):
+        path = os.path.join(self.dir, "nonce")
+        if not os.path.exists(path):
+            write_atomic(path, os.urandom(CACHE_NONCE_LEN), replace=False)
+        with open(path, "rb") as fp:
+            return fp.read()
+
+    # Evicts the least recently used entries of this key's directory until
+    # it fits in the size limit, keeping the entries this run used
+    # Returns the number of entries evicted
+    def evict(self):
+        entries = []
+        for name in os.listdir(self.dir):
+            if name.endswith(".frame"):
+                try:
+                    st = os.stat(os.path.join(self.dir, name))
+                except FileNotFoundError:
+                    continue
+                entries.append((st.st_mtime, st.st_size, name))
+        total = sum(size for _, size, _ in entries)
+        removed = 0
+        for _, size, name in sorted(entries):
+            if total <= self.max_bytes:
+                break
+            if name in self.used:
+                continue
+            try:
+                os.remove(os.path.join(self.dir, name))
+            except FileNotFoundError:
+                pass
+            total -= size
+            removed += 1
+        return removed
+
+    # Prints how many DATA frames were reused and how many entries evicted
+    def report(self, removed=0):
+        total = self.hits + self.misses
+        print(f"Frame cache: {self.hits} of {total} DATA frames reused ({100 * self.hits / max(total, 1):.1f}%), "
+              f"{self.misses} encrypted, {removed} entries evicted", file=sys.stderr)
+
+# Writes a file in one step, so readers never see part of it
+# Takes the path, the data, and whether to replace a file already there
+def write_atomic(path, data, replace=True):
+    fd, tmp = tempfile.mkstemp(dir=os.path.dirname(path))
+    with os.fdopen(fd, "wb") as fp:
+        fp.write(data)
+    if replace:
+        os.replace(tmp, path)
+        return
+    try:
+        os.link(tmp, path)
+    except FileExistsError:
+        pass
+    os.remove(tmp)
+
+# Yields the firmware followed by the release message in 1 KB chunks
+# Takes the firmware (bytes or mmap) and release message bytes
+# Only the chunk that straddles the two is copied
+def iter_chunks(firmware, messageBin):
+    total = len(firmware) + len(messageBin)
+    for i in range(0, total, CHUNK_SIZE):
+        if i + CHUNK_SIZE <= len(firmware):
+            yield firmware[i : i + CHUNK_SIZE]
+        elif i >= len(firmware):
+            yield messageBin[i - len(firmware) : i - len(firmware) + CHUNK_SIZE]
+        else:
+            yield firmware[i:] + messageBin[: i + CHUNK_SIZE - len(firmware)]
+
+# Yields every manifest page: firmware and release message, then each
+# bundle component in table order
+# Takes the firmware, release message and a list of (region id, data)
+def iter_pages(firmware, messageBin, components):
+    return itertools.chain(iter_chunks(firmware, messageBin),
+                           *(iter_chunks(data, b"") for _, data in components))
+
+# Stores the key, header and cache (directory, IV key and version, or
+# None) in a pool worker
+def init_worker(key, header, cache=None):
+    global worker_key, worker_header, worker_cache
+    worker_key = key
+    worker_header = header
+    worker_cache = cache
+
+# Builds one DATA frame in a pool worker, or takes it from the cache
+# Takes a (chunk, trailer) pair, trailer None for a hashed frame
+# Returns the frame, whether it came from the cache and its entry file
+# name (None without a cache)
+def data_frame(job):
+    chunk, trailer = job
+    chunk = bytes(chunk)
+    if worker_cache is None:
+        return make_frame(2, chunk, worker_key, worker_header, trailer), False, None
+
+    # The entry is named by everything the frame depends on besides the key:
+    # version, trailer (the page index of a manifest frame) and chunk
+    cache_dir, iv_key, version = worker_cache
+    entry = SHA256.new(p16(version, endian = "little") + (b"M" + trailer if trailer else b"H")
+                       + SHA256.new(chunk).digest()).digest()
+    name = entry.hex() + ".frame"
+    path = os.path.join(cache_dir, name)
+    try:
+        with open(path, "rb") as fp:
+            frame = fp.read()
+        if len(frame) == frame_size(len(chunk)):
+            os.utime(path) # Marks the entry as recently used
+            return frame, True, name
+    except FileNotFoundError:
+        pass
 
-    # Instantiate and read the key
-    key = b""
-    header = b""
+    seed = HMAC.new(iv_key, entry, SHA256).digest()
+    frame = make_frame(2, chunk, worker_key, worker_header, trailer, seed)
+    write_atomic(path, frame)
+    return frame, False, name
+
+# Builds DATA frames on a process pool, in input order
+# Takes an iterable of (chunk, trailer) jobs, key, header, worker count,
+# version and frame cache (or None)
+# Yields each frame as soon as it and all frames before it are done
+def data_frames(jobs, key, header, workers, version=0, cache=None):
+    state = (cache.dir, cache.iv_key, version) if cache else None
+    if workers <= 1:
+        init_worker(key, header, state)
+        yield from count_hits(map(data_frame, jobs), cache)
+        return
+    with multiprocessing.Pool(workers, init_worker, (key, header, state)) as pool:
+        yield from count_hits(pool.imap(data_frame, jobs, POOL_CHUNKSIZE), cache)
+
+# Yields the frames of data_frame results, counting cache hits and
+# noting the entries used
+# Takes the results and the frame cache (or None)
+def count_hits(results, cache):
+    for frame, hit, name in results:
+        if cache:
+            cache.hits += hit
+            cache.misses += not hit
+            cache.used.add(name)
+        yield frame
+
+# Yields the START, MANIFEST and DATA frames of a manifest update
+# Takes the firmware (bytes or mmap), release message bytes, version,
+# key, header, worker count, bundle components as a list of
+# (region id, data), any of which make this a bundle, and the frame
+# cache (or None)
+def manifest_frames(firmware, messageBin, version, key, header, workers, components=(), cache=None):
+    # Each leaf hashes the bytes that end up in that flash page
+    leaves = b"".join(SHA256.new(chunk).digest() for chunk in iter_pages(firmware, messageBin, components))
+    root = SHA256.new(leaves).digest()
+    page_count = len(leaves) // 32
+
+    # START frame: sizes, manifest marker, page count and root, then
+    # for a bundle the component count and (region id, size) entries
+    table = b""
+    if components:
+        table = p8(len(components), endian = "little")
+        for region, data in components:
+            table += p8(region, endian = "little") + p16(len(data), endian = "little")
+    temp = (p16(version, endian = "little") + p16(len(firmware), endian = "little") + p16(len(messageBin), endian = "little")
+            + (BUNDLE_MAGIC if components else MANIFEST_MAGIC) + p16(page_count, endian = "little") + root + table)
+    yield make_frame(1, temp, key, header)
+
+    # MANIFEST frames: 32 leaves each
+    for i in range(0, len(leaves), CHUNK_SIZE):
+        yield make_frame(MANIFEST_FRAME, leaves[i : i + CHUNK_SIZE], key, header)
+
+    # DATA frames: the trailer names the page instead of hashing it
+    jobs = ((chunk, p16(index, endian = "little") + bytes(30)) for index, chunk in enumerate(iter_pages(firmware, messageBin, components)))
+    yield from data_frames(jobs, key, header, workers, version, cache)
+
+# Yields the START and DATA frames of an update with a hash in every
+# DATA frame
+# Takes the firmware (bytes or mmap), release message bytes, version,
+# key, header, worker count and frame cache (or None)
+def hashed_frames(firmware, messageBin, version, key, header, workers, cache=None):
+    # Create START frame
+    # Temp is the version num + firmware len + RM len
+    temp = p16(version, endian = "little") + p16(len(firmware), endian = "little") + p16(len(messageBin), endian = "little")
+    yield make_frame(1, temp, key, header)
+
+    # DATA frames: firmware then release message, last one only as long as needed
+    jobs = ((chunk, None) for chunk in iter_chunks(firmware, messageBin))
+    yield from data_frames(jobs, key, header, workers, version, cache)
+
+# Reads the bundle components
+# Takes a list of "region=path" strings
+# Returns a list of (region id, data) sorted by region id, the order
+# in which the bootloader numbers their pages
+def load_components(specs):
+    components = []
+    for spec in specs:
+        name, _, path = spec.partition("=")
+        if name not in REGIONS or not path:
+            raise ValueError(f"component must be REGION=PATH with REGION one of {', '.join(REGIONS)}: {spec}")
+        region, limit = REGIONS[name]
+        if any(region == r for r, _ in components):
+            raise ValueError(f"region {name} given twice")
+        with open(path, 'rb') as fp:
+            data = fp.read()
+        if not 0 < len(data) <= limit:
+            raise ValueError(f"{path} must be 1 to {limit} bytes for region {name}")
+        components.append((region, data))
+    return sorted(components, key = lambda c: c[0])
+
+# Reads the AES key and header written by bl_build.py
+# Returns the key and header
+def read_secret():
     with open ("../bootloader/secret_build_output.txt", "rb") as fp:
         key = fp.read(16)
         fp.read(1); # Gets rid of new line between key
         header = fp.read(16)
+    return key, header
+
+# Packages the firmware lazily
+# Takes firmware location, version, release message, whether to add a
+# manifest, the number of worker processes (defaults to one per CPU),
+# "region=path" bundle components (which imply a manifest) and the
+# frame cache directory (None for no cache), its size limit in MB and
+# whether to empty it first
+# Yields every frame, START to END, as soon as it is ready; later
+# frames are encrypted in the background while earlier ones are used
+def protect_frames(infile, version, message, manifest=False, jobs=None, components=(), cache_dir=None,
+                   cache_size=CACHE_SIZE, cache_clear=False):
+    key, header = read_secret()
+    cache = FrameCache(cache_dir, key, header, cache_size, cache_clear) if cache_dir else None
 
-    # Encrypt the firmware
-    messageAndDataEncrypted = b""
-    i = 0
     messageBin = message.encode()
     messageBin += b"\x00"
-    firmwareAndMessage = firmware + messageBin #Smushes firmware adnd message together
-    # Breaks into chunks
-    for i in range (0, len(firmwareAndMessage), 1024):
-        # Check if the data fills a full 0x400 chunk
-        if ((len(firmwareAndMessage) - i) // 1024 != 0):
-            temp = p8(2, endian = "little") + encrypt(firmwareAndMessage[i : i + 1024], key, header) # Message type + firmware
-            messageAndDataEncrypted += temp
-    # If the last chunk is not a 0xF chunk, pads and encrypts
-    if (len(firmwareAndMessage) % 1024 != 0):
-        temp = randPad((firmwareAndMessage[i : len(firmwareAndMessage)]), 1024) # Message type + firmware + padding
-        messageAndDataEncrypted += p8(2, endian = "little") + encrypt(temp, key, header)
+    workers = jobs if jobs else os.cpu_count() or 1
+    bundle = load_components(components)
+
+    # Map the firmware instead of reading it (mmap rejects empty files)
+    with open(infile, 'rb') as fp:
+        size = os.fstat(fp.fileno()).st_size
+        firmware = mmap.mmap(fp.fileno(), 0, access = mmap.ACCESS_READ) if size else b""
 
+        try:
+            if manifest or bundle:
+                yield from manifest_frames(firmware, messageBin, version, key, header, workers, bundle, cache)
+            else:
+                yield from hashed_frames(firmware, messageBin, version, key, header, workers, cache)
 
-    # Create START frame
-    # Temp is the type + version num + firmware len + RM len + padding
-    temp = randPad(p16(version, endian = "little") + p16(len(firmware), endian = "little") + p16(len(messageBin), endian = "little"), 1024)
-    begin = p8(1, endian = "little") + encrypt(temp, key, header)
+            if cache:
+                cache.report(cache.evict())
 
-    # Create END frame
-    # Temp is the type + padding
-    temp = randPad(b"", 1024)
-    end = p8(3, endian = "little") + encrypt(temp, key, header)
+            # Create END frame, which has no payload
+            yield make_frame(3, b"", key, header)
+        finally:
+            if size:
+                firmware.close()
 
-    # For debugging?
-    # print(begin)
-    
-    # Smush the START frame, encrypted firmware and RM, and END frame together
-    firmware_blob = begin + messageAndDataEncrypted + end
-    # Write encrypted firmware blob to outfile
-    with open(outfile, 'wb+') as outfile:
-        outfile.write(firmware_blob)
+# Packages the firmware
+# Takes firmware location, output location ("-" for stdout), version,
+# release message, whether to add a manifest, the number of worker
+# processes (defaults to one per CPU), "region=path" bundle components
+# (which imply a manifest), the frame cache directory (or None), its
+# size limit in MB and whether to empty it first
+def protect_firmware(infile, outfile, version, message, manifest=False, jobs=None, components=(), cache_dir=None,
+                     cache_size=CACHE_SIZE, cache_clear=False):
+    frames = protect_frames(infile, version, message, manifest, jobs, components, cache_dir, cache_size, cache_clear)
+    if outfile == "-":
+        for frame in frames:
+            sys.stdout.buffer.write(frame)
+        sys.stdout.buffer.flush()
+        return
+    with open(outfile, 'wb+') as out:
+        for frame in frames:
+            out.write(frame)
     
 # Runs the program
 if __name__ == '__main__':
     parser = argparse.ArgumentParser(description='Firmware Update Tool')
     parser.add_argument("--infile", help="Path to the firmware image to protect.", required=True)
-    parser.add_argument("--outfile", help="Filename for the output firmware.", required=True)
+    parser.add_argument("--outfile", help="Filename for the output firmware, or - for stdout.", required=True)
     parser.add_argument("--version", help="Version number of this firmware.", required=True)
     parser.add_argument("--message", help="Release message for this firmware.", required=True)
+    parser.add_argument("--manifest", help="Authenticate pages with a manifest instead of per-frame hashes.", action="store_true")
+    parser.add_argument("--jobs", help="Worker processes for hashing and encryption (default: one per CPU).", type=int)
+    parser.add_argument("--component", help="Add REGION=PATH to a bundle (REGION: calibration or data). Implies --manifest.", action="append", default=[])
+    parser.add_argument("--cache", help="Directory of DATA frames to reuse for unchanged chunks (created if missing).", default=None)
+    parser.add_argument("--cache-size", help=f"Most MB of frames to keep per key; least recently used go first (default: {CACHE_SIZE}).", type=int, default=CACHE_SIZE)
+    parser.add_argument("--cache-clear", help="Empty this key's cache directory before packaging.", action="store_true")
     args = parser.parse_args()
 
-    protect_firmware(infile=args.infile, outfile=args.outfile, version=int(args.version), message=args.message)#Calls the firmware protect method
+    protect_firmware(infile=args.infile, outfile=args.outfile, version=int(args.version), message=args.message, manifest=args.manifest, jobs=args.jobs, components=args.component, cache_dir=args.cache, cache_size=args.cache_size, cache_clear=args.cache_clear)#Calls the firmware protect method
     # EXAMPLE COMMAND TO RUN THIS CODE
     # python3 ./fw_protect.py --infile ../firmware/gcc/main.bin --outfile ../firmware/gcc/protected.bin --version 0 --message lolz
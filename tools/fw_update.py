@@ -4,24 +4,46 @@
 # Approved for public release. Distribution unlimited 23-02181-13.
 
 import argparse
-import time
+import itertools
+import sys
+import threading
 import socket
 
 from util import *
 
 from Crypto.Util.Padding import pad
 from pwn import *
+from fw_protect import CACHE_SIZE, protect_frames
 
 OK = b"\x00"
 ERROR = b"\x01"
 END = b"\x02"
+TYPE = b"\x04"
+STRIPE = b"S" # On UART2: take DATA frames on this link too
 
-FRAME_SIZE = 1073
+STRIPE_TIMEOUT = 10.0 # Seconds without an answer before UART2 counts as failed
+
+FRAME_SIZE = 1073     # Fixed-size frame: type, 1056 byte ciphertext, IV
+FRAME_VARIABLE = 0x80 # Type flag of a frame with a 2 byte payload length
+MANIFEST_FRAME = 4
+END_FRAME = 3
+
+# Reads exactly length bytes from the serial object
+def read_exact(ser, length):
+    data = b""
+    while len(data) < length:
+        chunk = ser.read(length - len(data))
+        if not chunk:
+            raise RuntimeError("Link closed, aborting")
+        data += chunk
+    return data
 
 # Sends START frame
-# Takes serial object, meta frame, and debug
-def send_metadata(ser, metadata, debug=False):
-    ser.write(b"U")
+# Takes serial object, meta frame, debug, and whether the firmware already
+# requested update mode (the bootloader then sends 'U' without being asked)
+def send_metadata(ser, metadata, debug=False, requested=False):
+    if not requested:
+        ser.write(b"U")
 
     print("Waiting for bootloader to enter update mode...")
     while ser.read(1).decode() != "U":
@@ -31,9 +53,23 @@ def send_metadata(ser, metadata, debug=False):
     
     send_frame(ser, metadata, debug)
 
+# Reads a response: the TYPE byte and a status
+# Takes serial object and whether the link also carries debug text,
+# which is skipped (it never contains the TYPE byte)
+# Returns the type and the status
+def read_response(ser, text=False):
+    msgType = ser.read(1)
+    while text and msgType and msgType != TYPE:
+        msgType = ser.read(1)
+    if not msgType:
+        raise RuntimeError("Link closed, aborting")
+    return msgType, ser.read(1)
+
 # Sends frames
-# Takes serial object, frame, and debug
-def send_frame(ser, frame, debug=False):
+# Takes serial object, frame, debug, the number of bytes that follow a
+# successful response, and whether the link also carries debug text
+# Returns those extra bytes
+def send_frame(ser, frame, debug=False, extra=0, text=False):
 
     falsetimes = 0 # Error counter
     failed = True # Stores if sent frame was successful
@@ -48,12 +84,8 @@ def send_frame(ser, frame, debug=False):
         ser.write(frame) 
         
         # Get return message type and error number
-        msgType = ser.read(1)
-        errorNum = ser.read(1)
-
+        msgType, errorNum = read_response(ser, text)
 
-        time.sleep(0.1)
-        
         # If debug mode on, prints error type
         if debug:
             print("Resp: {}".format(ord(errorNum)))
@@ -63,6 +95,8 @@ def send_frame(ser, frame, debug=False):
             # Check for success
             if errorNum == OK:
                 failed = False
+                if extra:
+                    return read_exact(ser, extra)
             # Check for error
             elif errorNum == ERROR:
                 falsetimes += 1 # Increment error counter
@@ -75,23 +109,53 @@ def send_frame(ser, frame, debug=False):
         else:
             raise RuntimeError("Invalid message type, aborting")
 
+# Returns the type of a frame without the FRAME_VARIABLE flag
+def frame_type(frame):
+    return frame[0] & ~FRAME_VARIABLE
+
+# Splits a stream of protected frames, fixed-size or length-prefixed
+# Takes a binary file object: a file, a pipe or stdin
+# Yields each frame as soon as it has been read
+def read_frames(fp):
+    while True:
+        frame = fp.read(1)
+        if not frame:
+            return
+        if frame[0] & FRAME_VARIABLE:
+            frame += fp.read(2)
+            if len(frame) < 3:
+                raise RuntimeError("Truncated frame in input, aborting")
+            # Payload padded to the AES block, then trailer and IV
+            size = 3 + (u16(frame[1:3], endian = "little") + 15) // 16 * 16 + 32 + 16
+        else:
+            size = FRAME_SIZE
+        frame += fp.read(size - len(frame))
+        if len(frame) < size:
+            raise RuntimeError("Truncated frame in input, aborting")
+        yield frame
+
 # Sends all frames
-# Takes serial object, encrypted frames location, and debug
+# Takes serial object, an iterable of frames from START to END, debug,
+# whether the firmware requested update mode, and a second serial object
+# (UART2) to stripe DATA frames over, if any.
+# Frames are consumed one at a time, so they can still be in the making.
 # Returns serial object input
-def update(ser, infile, debug):
-    # Open and read file of encrypted packets
-    with open(infile, "rb") as fp:
-        firmware_blob = fp.read()
+def update(ser, frames, debug, requested=False, stripe=None):
+    frames = iter(frames)
 
     # Send START frame
-    metadata = firmware_blob[:1073]
-    send_metadata(ser, metadata, debug=debug)
+    send_metadata(ser, next(frames), debug=debug, requested=requested)
+
+    # A MANIFEST frame after START means pages can be sent selectively
+    frame = next(frames)
+    if frame_type(frame) == MANIFEST_FRAME:
+        update_manifest(ser, frame, frames, debug, stripe)
+        return ser
+    if stripe:
+        print("Not a manifest update, sending over UART1 only")
 
     # Send DATA, MESSAGE, and END frames
-    firmware = firmware_blob[1073:]
-    for idx, frame_start in enumerate(range(0, len(firmware), FRAME_SIZE)):
-        # Chunk and write frames
-        data = firmware[frame_start : frame_start + FRAME_SIZE]
+    for idx, data in enumerate(itertools.chain([frame], frames)):
         send_frame(ser, data, debug=debug)
         # Confirm frame has been written
         print(f"Wrote frame {idx} ({len(data)} bytes)")
@@ -101,38 +165,173 @@ def update(ser, infile, debug):
 
     return ser
 
+# Sends the MANIFEST frames, then only the DATA frames the bootloader
+# reports as missing, then the END frame
+# Takes serial object, the first MANIFEST frame, the remaining frames,
+# debug, and the serial object to stripe DATA frames over, if any
+def update_manifest(ser, frame, frames, debug, stripe=None):
+    # Each MANIFEST frame is held until the next one shows it is not the last
+    for following in frames:
+        if frame_type(following) != MANIFEST_FRAME:
+            break
+        send_frame(ser, frame, debug=debug)
+        frame = following
+
+    # The last MANIFEST frame is answered with the page count and the
+    # bitmap of needed pages
+    page_count = u16(send_frame(ser, frame, debug=debug, extra=2), endian = "little")
+    needed = read_exact(ser, (page_count + 7) // 8)
+
+    end = []
+    pages = needed_frames(following, frames, page_count, needed, end, debug)
+    if stripe and stripe_join(stripe):
+        send_striped([ser, stripe], pages, debug)
+    else:
+        if stripe:
+            print("Bootloader did not take UART2, sending over UART1 only")
+        for idx, frame in pages:
+            send_frame(ser, frame, debug=debug)
+            print(f"Wrote page {idx} ({len(frame)} bytes)")
+
+    send_frame(ser, end[0], debug=debug)
+    print("Done writing firmware.")
+
+# Picks the DATA frames of the pages the bootloader needs
+# Takes the first DATA frame, the remaining frames, the page count, the
+# bitmap of needed pages, a list that receives the END frame, and debug
+# Yields (page index, DATA frame)
+def needed_frames(frame, frames, page_count, needed, end, debug):
+    idx = 0
+    while frame_type(frame) != END_FRAME:
+        if idx >= page_count:
+            raise RuntimeError("More DATA frames than pages, aborting")
+        if needed[idx // 8] & (1 << (idx % 8)):
+            yield idx, frame
+        elif debug:
+            print(f"Skipped page {idx}, already on device")
+        idx += 1
+        frame = next(frames)
+    end.append(frame)
+
+# Asks the bootloader to take DATA frames on UART2 as well
+# Takes the UART2 serial object
+# Returns True if it agreed
+def stripe_join(link):
+    try:
+        link.write(STRIPE)
+        return read_response(link, text=True) == (TYPE, OK)
+    except (RuntimeError, OSError):
+        return False
+
+# Sends DATA frames over several links at once, each in its own thread.
+# A link sends a frame and waits for its answer before taking the next,
+# so each keeps its own flow control. A link that fails hands its frame
+# back and stops, and the others send the rest. The first link (UART1)
+# carries the rest of the update, so its failure ends the update.
+# Takes the serial objects, the (page index, DATA frame) pairs, and debug
+def send_striped(links, pages, debug):
+    lock = threading.Lock()
+    retry = []  # Frames handed back by failed links
+    errors = [] # Failure of the first link, or of the frame source
+
+    def take():
+        with lock:
+            if errors:
+                return None
+            if retry:
+                return retry.pop()
+            try:
+                return next(pages, None)
+            except Exception as e:
+                errors.append(e)
+                return None
+
+    def run(n, ser):
+        while True:
+            item = take()
+            if item is None:
+                return
+            idx, frame = item
+            try:
+                send_frame(ser, frame, debug=debug, text=n > 0)
+            except (RuntimeError, OSError) as e:
+                with lock:
+                    retry.append(item)
+                    if n == 0:
+                        errors.append(e)
+                print(f"UART{n + 1} failed ({e}), sending over the other link")
+                return
+            print(f"Wrote page {idx} ({len(frame)} bytes) on UART{n + 1}")
+
+    threads = [threading.Thread(target=run, args=(n, ser)) for n, ser in enumerate(links)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    if errors:
+        raise errors[0]
+
+    # A link that failed last may have handed back a frame nobody took
+    for idx, frame in retry:
+        send_frame(links[0], frame, debug=debug)
+        print(f"Wrote page {idx} ({len(frame)} bytes) on UART1")
+
 # Carries out program
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description="Firmware Update Tool")
 
     parser.add_argument("--port", help="Does nothing, included to adhere to command examples in rule doc", required=False)
-    parser.add_argument("--firmware", help="Path to firmware image to load.", required=False)
+    parser.add_argument("--firmware", help="Path to the protected firmware to load, or - to read it from stdin.", required=False)
+    parser.add_argument("--package", help="Protect this raw firmware image while sending it, instead of --firmware.")
+    parser.add_argument("--version", help="Version number, with --package.", type=int, default=0)
+    parser.add_argument("--message", help="Release message, with --package.", default="")
+    parser.add_argument("--manifest", help="Send a manifest update, with --package.", action="store_true")
+    parser.add_argument("--component", help="Add REGION=PATH to a bundle, with --package.", action="append", default=[])
+    parser.add_argument("--jobs", help="Packaging worker processes, with --package.", type=int)
+    parser.add_argument("--cache", help="Frame cache directory (see fw_protect.py), with --package.", default=None)
+    parser.add_argument("--cache-size", help="Most MB of frames to keep per key, with --cache.", type=int, default=CACHE_SIZE)
+    parser.add_argument("--cache-clear", help="Empty this key's cache directory first, with --cache.", action="store_true")
+    parser.add_argument("--request", help="Ask the running firmware to reset into update mode (UPDATE on its console) instead of sending 'U'.", action="store_true")
+    parser.add_argument("--stripe", help="Send the DATA frames of a manifest update over UART1 and UART2 at once.", action="store_true")
     parser.add_argument("--debug", help="Enable debugging messages.", action="store_true")
+    parser.add_argument("--uart-dir", help="Socket directory of the emulator instance (see bl_pool.py).", default=UART_DIR)
     args = parser.parse_args()
 
-    # Open UART 0
-    uart0_sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
-    uart0_sock.connect(UART0_PATH)
-
-    time.sleep(0.2)  # QEMU takes a moment to open the next socket
-
-    # Open UART 1
-    uart1_sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
-    uart1_sock.connect(UART1_PATH)
+    # Open UARTs 0-2 in order. QEMU only listens on the next socket once
+    # the previous one has a client, so each connect waits until it can.
+    uart0_path, uart1_path, uart2_path = uart_paths(args.uart_dir)
+    uart0_sock = connect_uart(uart0_path)
+    uart1_sock = connect_uart(uart1_path)
     uart1 = DomainSocketSerial(uart1_sock)
+    uart2_sock = connect_uart(uart2_path)
 
-    time.sleep(0.2)
-
-    # Open UART 2
-    uart2_sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
-    uart2_sock.connect(UART2_PATH)
+    # The firmware's console is UART2. UPDATE makes it leave a request in
+    # the bootloader mailbox and reset.
+    if args.request:
+        uart2_sock.sendall(b"UPDATE\n")
 
-    # Close unused UARTs 0 & 2 (if we leave these open it will hang)
+    # Close unused UARTs 0 & 2 (if we leave these open it will hang).
+    # Striping keeps UART2 as a second link.
     uart0_sock.close()
-    uart2_sock.close()
+    uart2 = None
+    if args.stripe:
+        uart2_sock.settimeout(STRIPE_TIMEOUT)
+        uart2 = DomainSocketSerial(uart2_sock)
+    else:
+        uart2_sock.close()
 
-    # Start updating
-    update(ser=uart1, infile=args.firmware, debug=args.debug)
+    # Start updating. Frames are sent as they are read or packaged.
+    if args.package:
+        frames = protect_frames(args.package, args.version, args.message, args.manifest, args.jobs, args.component, args.cache,
+                                args.cache_size, args.cache_clear)
+        update(ser=uart1, frames=frames, debug=args.debug, requested=args.request, stripe=uart2)
+    elif args.firmware == "-":
+        update(ser=uart1, frames=read_frames(sys.stdin.buffer), debug=args.debug, requested=args.request, stripe=uart2)
+    else:
+        with open(args.firmware, "rb") as fp:
+            update(ser=uart1, frames=read_frames(fp), debug=args.debug, requested=args.request, stripe=uart2)
 
-    # Close UART 1
+    # Close UARTs 1 & 2
     uart1_sock.close()
+    if uart2:
+        uart2.close()
@@ -0,0 +1,208 @@
+// Copyright 2023 The MITRE Corporation and team BRUGH!!. ALL RIGHTS RESERVED
+// Approved for public release. Distribution unlimited 23-02181-13.
+
+// Library Imports
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Application Imports
+#include <qemu-plugin.h>
+
+/*
+ * QEMU TCG plugin that counts executed guest instructions per symbol.
+ *
+ * Loaded by bl_bench.py as
+ *   -plugin libbl_insn.so,syms=FILE,out=FILE
+ * where the syms file has one "start end name" line (hex addresses) per
+ * function in main.axf. Every translated instruction gets an inline
+ * counter for its symbol, so an exception or interrupt that leaves a
+ * block early only counts the instructions that ran. A block that
+ * starts on a symbol's first instruction also counts as one entry.
+ *
+ * Counts are exact and independent of host speed, unlike wall clock
+ * time under QEMU. On exit "name instructions entries" is written for
+ * every symbol that ran; code outside all symbols (the booted firmware)
+ * is reported as "(unmapped)".
+ */
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;     // Exclusive
+    char *name;
+    uint64_t insns;
+    uint64_t entries;
+} bl_symbol;
+
+static bl_symbol *symbols = NULL; // Sorted by start
+static size_t n_symbols = 0;
+static bl_symbol unmapped = { 0, 0, "(unmapped)", 0, 0 };
+static char *out_path = NULL;
+
+#if QEMU_PLUGIN_VERSION >= 2
+// QEMU 9.0 replaced plain inline counters with per-vCPU scoreboards:
+// one uint64_t per symbol, unmapped last
+static struct qemu_plugin_scoreboard *counts = NULL;
+
+static qemu_plugin_u64 symbol_counter(bl_symbol *sym){
+    size_t index = sym == &unmapped ? n_symbols : (size_t)(sym - symbols);
+    return (qemu_plugin_u64){ counts, index * sizeof(uint64_t) };
+}
+#endif
+
+static int symbol_order(const void *a, const void *b){
+    const bl_symbol *x = a;
+    const bl_symbol *y = b;
+
+    if (x->start != y->start){
+        return x->start < y->start ? -1 : 1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+/* ****************************************************************
+ *
+ * Loads the symbol ranges written by bl_bench.py.
+ *
+ * \param path is the file to read.
+ *
+ * \return Returns 0 on success, -1 if the file can't be read
+ *
+ * ****************************************************************
+ */
+static int load_symbols(const char *path){
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL){
+        return -1;
+    }
+
+    size_t capacity = 0;
+    uint64_t start, end;
+    char name[256];
+    while (fscanf(fp, "%" SCNx64 " %" SCNx64 " %255s", &start, &end, name) == 3){
+        if (end <= start){
+            continue;
+        }
+        if (n_symbols == capacity){
+            capacity = capacity ? capacity * 2 : 256;
+            symbols = realloc(symbols, capacity * sizeof(*symbols));
+        }
+        symbols[n_symbols++] = (bl_symbol){ start, end, strdup(name), 0, 0 };
+    }
+    fclose(fp);
+
+    qsort(symbols, n_symbols, sizeof(*symbols), symbol_order);
+    return 0;
+}
+
+// Returns the symbol containing addr, or the unmapped bucket
+static bl_symbol *symbol_at(uint64_t addr){
+    size_t lo = 0, hi = n_symbols;
+
+    // Last symbol starting at or before addr
+    while (lo < hi){
+        size_t mid = (lo + hi) / 2;
+        if (symbols[mid].start <= addr){
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo > 0 && addr < symbols[lo - 1].end){
+        return &symbols[lo - 1];
+    }
+    return &unmapped;
+}
+
+// Runs when a block that starts a symbol executes; its first
+// instruction always runs, so the entry always counts
+static void block_exec(unsigned int vcpu_index, void *udata){
+    bl_symbol *entered = udata;
+
+    entered->entries++;
+}
+
+// Adds one to the symbol's count each time the instruction executes
+static void count_insn(struct qemu_plugin_insn *insn, bl_symbol *sym){
+#if QEMU_PLUGIN_VERSION >= 2
+    qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(insn, QEMU_PLUGIN_INLINE_ADD_U64, symbol_counter(sym), 1);
+#else
+    qemu_plugin_register_vcpu_insn_exec_inline(insn, QEMU_PLUGIN_INLINE_ADD_U64, &sym->insns, 1);
+#endif
+}
+
+static void block_translate(qemu_plugin_id_t id, struct qemu_plugin_tb *tb){
+    size_t n = qemu_plugin_tb_n_insns(tb);
+
+    for (size_t i = 0; i < n; i++){
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+        uint64_t addr = qemu_plugin_insn_vaddr(insn);
+        bl_symbol *sym = symbol_at(addr);
+
+        if (i == 0 && sym != &unmapped && addr == sym->start){
+            qemu_plugin_register_vcpu_tb_exec_cb(tb, block_exec, QEMU_PLUGIN_CB_NO_REGS, sym);
+        }
+        count_insn(insn, sym);
+    }
+}
+
+static void write_counts(FILE *fp, bl_symbol *sym){
+#if QEMU_PLUGIN_VERSION >= 2
+    sym->insns = qemu_plugin_u64_sum(symbol_counter(sym));
+#endif
+    if (sym->insns != 0){
+        fprintf(fp, "%s %" PRIu64 " %" PRIu64 "\n", sym->name, sym->insns, sym->entries);
+    }
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p){
+    FILE *fp = out_path ? fopen(out_path, "w") : stderr;
+    if (fp == NULL){
+        return;
+    }
+
+    for (size_t i = 0; i < n_symbols; i++){
+        write_counts(fp, &symbols[i]);
+    }
+    write_counts(fp, &unmapped);
+
+    if (fp != stderr){
+        fclose(fp);
+    }
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                                           int argc, char **argv){
+    const char *syms_path = NULL;
+
+    for (int i = 0; i < argc; i++){
+        if (strncmp(argv[i], "syms=", 5) == 0){
+            syms_path = argv[i] + 5;
+        } else if (strncmp(argv[i], "out=", 4) == 0){
+            out_path = strdup(argv[i] + 4);
+        } else {
+            fprintf(stderr, "bl_insn: unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    // The entry counters are not atomic, so only a single guest CPU is supported
+    if (info->system_emulation && info->system.max_vcpus > 1){
+        fprintf(stderr, "bl_insn: only one vCPU is supported\n");
+        return -1;
+    }
+    if (syms_path == NULL || load_symbols(syms_path) != 0){
+        fprintf(stderr, "bl_insn: syms=FILE is required and must be readable\n");
+        return -1;
+    }
+#if QEMU_PLUGIN_VERSION >= 2
+    counts = qemu_plugin_scoreboard_new((n_symbols + 1) * sizeof(uint64_t));
+#endif
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, block_translate);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
@@ -3,12 +3,36 @@
 # Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
 # Approved for public release. Distribution unlimited 23-02181-13.
 
+import os
 import socket
+import time
 
+UART_DIR = "/embsec"
 UART0_PATH = "/embsec/UART0"
 UART1_PATH = "/embsec/UART1"
 UART2_PATH = "/embsec/UART2"
 
+# Returns the UART0-2 socket paths of an emulator instance
+# Takes the instance's socket directory
+def uart_paths(uart_dir=UART_DIR):
+    return [os.path.join(uart_dir, f"UART{i}") for i in range(3)]
+
+# Connects to a QEMU UART socket, retrying until QEMU is listening
+# Takes the socket path and how long to wait in seconds
+# Returns the connected socket
+def connect_uart(path, timeout=10.0):
+    deadline = time.monotonic() + timeout
+    while True:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            sock.connect(path)
+            return sock
+        except (FileNotFoundError, ConnectionRefusedError):
+            sock.close()
+            if time.monotonic() > deadline:
+                raise TimeoutError(f"{path} not ready after {timeout}s")
+            time.sleep(0.01)
+
 class DomainSocketSerial:
     def __init__(self, ser_socket: socket.socket):
         self.ser_socket = ser_socket